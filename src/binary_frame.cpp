@@ -0,0 +1,188 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include "binary_frame.hpp"
+#include "luma.hpp"
+#include "sequencer.hpp"
+#include "utils/log.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static_assert(FRAME_TILE_SIZE == 64, "Each word of a binary row must span exactly one tile");
+
+/**
+ * @brief The fastest binary row differencing kernel this CPU supports, chosen
+ * by `initialize_binary_kernels()`.
+ */
+unsigned long long (*difference_binary_row)(
+    const unsigned long long *previous_row,
+    const unsigned long long *row,
+    int words,
+    unsigned int *tile_differences);
+
+/**
+ * @brief A few rows of luma, small enough to stay in the L1 cache between
+ * being extracted and being binarized.
+ */
+cv::Mat binary_luma_strip_buffer;
+
+/**
+ * @brief Pack one row of luma into bits, one per pixel, set where the pixel is
+ * darker than the threshold.
+ */
+void binarize_row(const unsigned char *luma_row, unsigned long long *binary_row, int width, int threshold)
+{
+  int column = 0;
+
+#if defined(__x86_64__)
+  // Compare 16 pixels at a time, biased so that a signed compare orders them
+  // as unsigned, and gather the results into bits.
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  const __m128i biased_threshold = _mm_set1_epi8((char)(threshold ^ 0x80));
+  for (; column + 64 <= width; column += 64)
+  {
+    unsigned long long word = 0;
+    for (int part = 0; part < 4; ++part)
+    {
+      __m128i pixels = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(luma_row + column + 16 * part)), bias);
+      unsigned long long bits = (unsigned int)_mm_movemask_epi8(_mm_cmplt_epi8(pixels, biased_threshold));
+      word |= bits << (16 * part);
+    }
+    binary_row[column / 64] = word;
+  }
+#endif
+
+  // Pack the remaining pixels one at a time, leaving the padding bits clear.
+  for (; column < width; column += 64)
+  {
+    unsigned long long word = 0;
+    for (int bit = 0; bit < 64 && column + bit < width; ++bit)
+      word |= (unsigned long long)(luma_row[column + bit] < threshold) << bit;
+    binary_row[column / 64] = word;
+  }
+}
+
+/**
+ * @brief Count the pixels that differ between two binary rows, adding each
+ * word's count to its tile. Returns the row's total.
+ */
+unsigned long long difference_binary_row_generic(
+    const unsigned long long *previous_row,
+    const unsigned long long *row,
+    int words,
+    unsigned int *tile_differences)
+{
+  unsigned long long sum = 0;
+  for (int word = 0; word < words; ++word)
+  {
+    unsigned int count = __builtin_popcountll(previous_row[word] ^ row[word]);
+    tile_differences[word] += count;
+    sum += count;
+  }
+  return sum;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Count the pixels that differ between two binary rows with the
+ * hardware popcount instruction, adding each word's count to its tile.
+ * Returns the row's total.
+ */
+__attribute__((target("popcnt"))) unsigned long long difference_binary_row_popcnt(
+    const unsigned long long *previous_row,
+    const unsigned long long *row,
+    int words,
+    unsigned int *tile_differences)
+{
+  unsigned long long sum = 0;
+  for (int word = 0; word < words; ++word)
+  {
+    unsigned int count = _mm_popcnt_u64(previous_row[word] ^ row[word]);
+    tile_differences[word] += count;
+    sum += count;
+  }
+  return sum;
+}
+#endif
+
+/**
+ * @brief Choose the fastest binary kernels this CPU supports.
+ *
+ * Without the `popcnt` instruction, x86 falls back to the compiler's software
+ * popcount. ARM always counts with its vector `cnt` instruction.
+ */
+void initialize_binary_kernels()
+{
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("popcnt"))
+  {
+    difference_binary_row = difference_binary_row_popcnt;
+    write_log("Binary Kernels: POPCNT");
+    return;
+  }
+#endif
+  difference_binary_row = difference_binary_row_generic;
+  write_log("Binary Kernels: Generic");
+}
+
+/**
+ * @brief Binarize the luma of a frame's region of interest into its binary
+ * buffer, a strip of rows at a time, without storing the luma. Returns the sum
+ * of the region's luma, from which an adaptive threshold can be derived.
+ */
+unsigned long long binarize_frame(Frame *frame, int threshold)
+{
+  const cv::Rect &region_of_interest = frame->region_of_interest;
+  int columns = region_of_interest.width;
+  int first_word = region_of_interest.x / 64;
+  binary_luma_strip_buffer.create(LUMA_STRIP_ROWS, columns, CV_8UC1);
+
+  unsigned long long luma_sum = 0;
+  for (int first_row = region_of_interest.y; first_row < region_of_interest.y + region_of_interest.height; first_row += LUMA_STRIP_ROWS)
+  {
+    int row_count = std::min(LUMA_STRIP_ROWS, region_of_interest.y + region_of_interest.height - first_row);
+    cv::Rect region(region_of_interest.x, first_row, columns, row_count);
+    cv::Mat luma_strip = get_luma_region(frame, region, binary_luma_strip_buffer.rowRange(0, row_count));
+    for (int row = 0; row < row_count; ++row)
+      binarize_row(
+          luma_strip.ptr(row),
+          frame->binary_buffer.ptr<unsigned long long>(first_row + row) + first_word,
+          columns,
+          threshold);
+    luma_sum += (unsigned long long)cv::sum(luma_strip)[0];
+  }
+
+  return luma_sum;
+}
+
+/**
+ * @brief Count the pixels in the frame's region of interest that differ
+ * between two binarized frames, with XOR and popcount, and fill in the
+ * frame's tile difference map with the count of each tile.
+ *
+ * The region is aligned to the tile grid, so it starts on a word boundary.
+ */
+unsigned long long difference_binary_frames(Frame *previous_frame, Frame *frame)
+{
+  const cv::Rect &region_of_interest = frame->region_of_interest;
+  int first_word = region_of_interest.x / 64;
+  int words = (region_of_interest.width + 63) / 64;
+  frame->tile_difference_map.setTo(cv::Scalar(0));
+
+  unsigned long long sum = 0;
+  for (int row = region_of_interest.y; row < region_of_interest.y + region_of_interest.height; ++row)
+    sum += difference_binary_row(
+        previous_frame->binary_buffer.ptr<unsigned long long>(row) + first_word,
+        frame->binary_buffer.ptr<unsigned long long>(row) + first_word,
+        words,
+        frame->tile_difference_map.ptr<unsigned int>(row / FRAME_TILE_SIZE) + first_word);
+  return sum;
+}
@@ -0,0 +1,10 @@
+#ifndef BINARY_FRAME_H
+#define BINARY_FRAME_H
+
+#include "sequencer.hpp"
+
+void initialize_binary_kernels();
+unsigned long long binarize_frame(Frame *frame, int threshold);
+unsigned long long difference_binary_frames(Frame *previous_frame, Frame *frame);
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <errno.h>
+#include <opencv2/core.hpp>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "frame_arena.hpp"
+#include "sequencer.hpp"
+#include "utils/error.h"
+#include "utils/log.h"
+
+/**
+ * @brief Round a size up to a multiple of the given power-of-two alignment.
+ */
+size_t align_size(size_t size, size_t alignment)
+{
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * @brief Reserve one contiguous region holding the color, luma and binary
+ * buffers and tile difference maps of every frame in the pipeline, and point
+ * each frame's buffers into it.
+ *
+ * Each buffer starts on a `FRAME_ARENA_ALIGNMENT` boundary. The region is
+ * backed by huge pages if the pipeline asks for them and the system has them
+ * reserved, and by normal pages otherwise. It is prefaulted and locked into
+ * memory, so the capture and difference stages never allocate or page fault.
+ *
+ * Passing `FRAME_ARENA_NO_COLOR_BUFFERS` as the type reserves no color
+ * buffers, for capture backends that supply their own color buffers.
+ *
+ * The frame size is published in the pipeline for the other services' setup.
+ */
+void initialize_frame_arena(FramePipeline *frame_pipeline, int rows, int columns, int type)
+{
+  FrameArena *frame_arena = &frame_pipeline->frame_arena;
+
+  // Lay out each frame's buffers.
+  size_t color_size = 0;
+  if (type != FRAME_ARENA_NO_COLOR_BUFFERS)
+    color_size = align_size((size_t)rows * columns * CV_ELEM_SIZE(type), FRAME_ARENA_ALIGNMENT);
+  size_t luma_size = align_size((size_t)rows * columns, FRAME_ARENA_ALIGNMENT);
+  int tile_rows = (rows + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+  int tile_columns = (columns + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+  size_t tile_map_size = align_size((size_t)tile_rows * tile_columns * sizeof(unsigned int), FRAME_ARENA_ALIGNMENT);
+  int binary_words_per_row = (columns + 63) / 64;
+  size_t binary_size = align_size((size_t)rows * binary_words_per_row * sizeof(unsigned long long), FRAME_ARENA_ALIGNMENT);
+  size_t frame_size = color_size + luma_size + tile_map_size + binary_size;
+
+  // Map the region, preferring huge pages.
+  frame_arena->memory = MAP_FAILED;
+  frame_arena->is_huge_page_backed = FALSE;
+  if (frame_pipeline->use_huge_pages)
+  {
+    frame_arena->size = align_size(frame_size * NUMBER_OF_FRAMES, HUGE_PAGE_SIZE);
+    frame_arena->memory = mmap(
+        NULL,
+        frame_arena->size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+        -1,
+        0);
+    if (frame_arena->memory == MAP_FAILED)
+      write_log("Frame Arena: Huge pages unavailable, falling back to normal pages");
+    else
+      frame_arena->is_huge_page_backed = TRUE;
+  }
+  if (frame_arena->memory == MAP_FAILED)
+  {
+    frame_arena->size = align_size(frame_size * NUMBER_OF_FRAMES, sysconf(_SC_PAGESIZE));
+    frame_arena->memory = mmap(
+        NULL,
+        frame_arena->size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+        -1,
+        0);
+    if (frame_arena->memory == MAP_FAILED)
+      print_with_errno_and_exit("mmap() frame arena");
+  }
+
+  // Prefault every page and keep it resident.
+  memset(frame_arena->memory, 0, frame_arena->size);
+  attempt(mlock(frame_arena->memory, frame_arena->size), "mlock() frame arena");
+
+  // Wrap each frame's buffers around the arena.
+  unsigned char *frame_memory = (unsigned char *)frame_arena->memory;
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+  {
+    Frame *frame = &frame_pipeline->frames[index];
+    if (type != FRAME_ARENA_NO_COLOR_BUFFERS)
+      frame->frame_buffer = cv::Mat(rows, columns, type, frame_memory);
+    frame->luma_buffer = cv::Mat(rows, columns, CV_8UC1, frame_memory + color_size);
+    frame->tile_difference_map = cv::Mat(tile_rows, tile_columns, CV_32SC1, frame_memory + color_size + luma_size);
+    frame->binary_buffer = cv::Mat(
+        rows,
+        binary_words_per_row * (int)sizeof(unsigned long long),
+        CV_8UC1,
+        frame_memory + color_size + luma_size + tile_map_size);
+    frame_memory += frame_size;
+  }
+
+  // Publish the frame size for the services set up after capture.
+  frame_pipeline->frame_size = cv::Size(columns, rows);
+
+  write_log(
+      "Frame Arena: %zu bytes, %zu bytes per frame, %s pages",
+      frame_arena->size,
+      frame_size,
+      frame_arena->is_huge_page_backed ? "huge" : "normal");
+}
+
+/**
+ * @brief Release the frame arena. The frames' buffers must no longer be used.
+ */
+void uninitialize_frame_arena(FramePipeline *frame_pipeline)
+{
+  FrameArena *frame_arena = &frame_pipeline->frame_arena;
+  if (frame_arena->memory == NULL)
+    return;
+
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+  {
+    frame_pipeline->frames[index].frame_buffer.release();
+    frame_pipeline->frames[index].luma_buffer.release();
+    frame_pipeline->frames[index].tile_difference_map.release();
+    frame_pipeline->frames[index].binary_buffer.release();
+  }
+
+  attempt(munlock(frame_arena->memory, frame_arena->size), "munlock() frame arena");
+  attempt(munmap(frame_arena->memory, frame_arena->size), "munmap() frame arena");
+  frame_arena->memory = NULL;
+}
+
+/**
+ * @brief Determine whether a frame's color buffer still lies in the arena,
+ * which it would not if OpenCV had reallocated it.
+ */
+int is_frame_in_arena(FramePipeline *frame_pipeline, Frame *frame)
+{
+  FrameArena *frame_arena = &frame_pipeline->frame_arena;
+  unsigned char *memory = (unsigned char *)frame_arena->memory;
+  return frame->frame_buffer.data >= memory && frame->frame_buffer.data < memory + frame_arena->size;
+}
@@ -0,0 +1,14 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include "sequencer.hpp"
+
+#define FRAME_ARENA_ALIGNMENT (64)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define FRAME_ARENA_NO_COLOR_BUFFERS (-1)
+
+void initialize_frame_arena(FramePipeline *frame_pipeline, int rows, int columns, int type);
+void uninitialize_frame_arena(FramePipeline *frame_pipeline);
+int is_frame_in_arena(FramePipeline *frame_pipeline, Frame *frame);
+
+#endif
@@ -0,0 +1,237 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "frame_queue.hpp"
+#include "sequencer.hpp"
+#include "utils/error.h"
+#include "utils/time.h"
+
+/**
+ * @brief Initialize a frame queue using the given backend. A queue with
+ * multiple producers serializes them with a priority-inheritance mutex when
+ * the backend itself only supports a single producer.
+ */
+void initialize_frame_queue(FrameQueue *queue, const char *name, FrameQueueBackend backend, struct mq_attr *attributes, int is_multiple_producer)
+{
+  queue->name = name;
+  queue->backend = backend;
+  queue->is_multiple_producer = is_multiple_producer && backend == FRAME_QUEUE_BACKEND_RING_BUFFER;
+  queue->maximum_send_nanoseconds = 0;
+  queue->maximum_receive_nanoseconds = 0;
+  if (queue->is_multiple_producer)
+  {
+    pthread_mutexattr_t mutex_attributes;
+    errno = pthread_mutexattr_init(&mutex_attributes);
+    if (errno)
+      print_with_errno_and_exit("pthread_mutexattr_init()");
+    errno = pthread_mutexattr_setprotocol(&mutex_attributes, PTHREAD_PRIO_INHERIT);
+    if (errno)
+      print_with_errno_and_exit("pthread_mutexattr_setprotocol()");
+    errno = pthread_mutex_init(&queue->producer_mutex, &mutex_attributes);
+    if (errno)
+      print_with_errno_and_exit("pthread_mutex_init()");
+    pthread_mutexattr_destroy(&mutex_attributes);
+  }
+  if (backend != FRAME_QUEUE_BACKEND_MESSAGE_QUEUE)
+    return;
+
+  mq_unlink(name);
+  queue->message_queue = mq_open(name, O_CREAT | O_RDWR, S_IRWXU, attributes);
+  if (queue->message_queue == -1)
+    print_with_errno_and_exit("mq_open() failed opening %s", name);
+}
+
+/**
+ * @brief Release the resources used by a frame queue.
+ */
+void uninitialize_frame_queue(FrameQueue *queue)
+{
+  if (queue->is_multiple_producer)
+    pthread_mutex_destroy(&queue->producer_mutex);
+  if (queue->backend != FRAME_QUEUE_BACKEND_MESSAGE_QUEUE)
+    return;
+
+  attempt(mq_close(queue->message_queue), "mq_close() %s", queue->name);
+  mq_unlink(queue->name);
+}
+
+/**
+ * @brief Keep track of the longest time spent in a queue operation that holds
+ * a lock shared with other services. Any of those services may record a time
+ * at once, so the maximum is updated atomically.
+ */
+void record_queue_operation_time(long long *maximum_nanoseconds, struct timespec *start_time)
+{
+  struct timespec complete_time;
+  get_current_monotonic_raw_time(&complete_time);
+  long long nanoseconds = get_elapsed_time_in_nanoseconds(start_time, &complete_time);
+  long long maximum = __atomic_load_n(maximum_nanoseconds, __ATOMIC_RELAXED);
+  while (nanoseconds > maximum &&
+         !__atomic_compare_exchange_n(
+             maximum_nanoseconds, &maximum, nanoseconds, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/**
+ * @brief Add a frame to a queue, blocking while the queue is full.
+ *
+ * Sends to a message queue, and pushes serialized by the producer mutex, are
+ * timed, since a lower-priority service may block another for their duration.
+ */
+void enqueue_frame(FrameQueue *queue, Frame *frame)
+{
+  struct timespec start_time;
+  switch (queue->backend)
+  {
+  case FRAME_QUEUE_BACKEND_MESSAGE_QUEUE:
+    get_current_monotonic_raw_time(&start_time);
+    attempt(
+        mq_send(queue->message_queue, (const char *)&frame, sizeof(Frame *), 0),
+        "mq_send() %s",
+        queue->name);
+    record_queue_operation_time(&queue->maximum_send_nanoseconds, &start_time);
+    break;
+  case FRAME_QUEUE_BACKEND_RING_BUFFER:
+    if (queue->is_multiple_producer)
+    {
+      errno = pthread_mutex_lock(&queue->producer_mutex);
+      if (errno)
+        print_with_errno_and_exit("pthread_mutex_lock() %s", queue->name);
+      get_current_monotonic_raw_time(&start_time);
+    }
+    queue->ring_buffer.push(frame);
+    if (queue->is_multiple_producer)
+    {
+      record_queue_operation_time(&queue->maximum_send_nanoseconds, &start_time);
+      errno = pthread_mutex_unlock(&queue->producer_mutex);
+      if (errno)
+        print_with_errno_and_exit("pthread_mutex_unlock() %s", queue->name);
+    }
+    break;
+  }
+}
+
+/**
+ * @brief Remove the next frame from a queue, blocking while the queue is
+ * empty.
+ */
+Frame *dequeue_frame(FrameQueue *queue)
+{
+  Frame *frame = NULL;
+  switch (queue->backend)
+  {
+  case FRAME_QUEUE_BACKEND_MESSAGE_QUEUE:
+    attempt(
+        mq_receive(queue->message_queue, (char *)&frame, sizeof(Frame *), NULL),
+        "mq_receive() %s",
+        queue->name);
+    break;
+  case FRAME_QUEUE_BACKEND_RING_BUFFER:
+    queue->ring_buffer.pop(&frame);
+    break;
+  }
+  return frame;
+}
+
+/**
+ * @brief Remove the next frame from a queue, blocking while the queue is empty
+ * until the given relative timeout elapses. Returns `TRUE` if a frame was
+ * removed.
+ */
+int timed_dequeue_frame(FrameQueue *queue, Frame **frame, const struct timespec *timeout)
+{
+  switch (queue->backend)
+  {
+  case FRAME_QUEUE_BACKEND_MESSAGE_QUEUE:
+  {
+    // Message queues take an absolute timeout on the realtime clock.
+    struct timespec deadline;
+    get_current_realtime_time(&deadline);
+    add_nanoseconds_to_timespec(&deadline, get_time_in_nanoseconds((struct timespec *)timeout));
+    if (mq_timedreceive(queue->message_queue, (char *)frame, sizeof(Frame *), NULL, &deadline) != -1)
+      return TRUE;
+    if (errno != ETIMEDOUT)
+      print_with_errno_and_exit("mq_timedreceive() %s", queue->name);
+    return FALSE;
+  }
+  case FRAME_QUEUE_BACKEND_RING_BUFFER:
+    return queue->ring_buffer.timed_pop(frame, timeout);
+  }
+  return FALSE;
+}
+
+/**
+ * @brief Remove the next frame from a queue if there is one, without blocking.
+ * Returns `TRUE` if a frame was removed.
+ *
+ * Receives from a message queue are timed, since they never wait for a
+ * message, and so only take as long as the message queue's lock is held.
+ */
+int try_dequeue_frame(FrameQueue *queue, Frame **frame)
+{
+  switch (queue->backend)
+  {
+  case FRAME_QUEUE_BACKEND_MESSAGE_QUEUE:
+  {
+    // A deadline in the past only returns a message that is already queued.
+    const struct timespec deadline = {.tv_sec = 0, .tv_nsec = 0};
+    struct timespec start_time;
+    get_current_monotonic_raw_time(&start_time);
+    int is_received = mq_timedreceive(queue->message_queue, (char *)frame, sizeof(Frame *), NULL, &deadline) != -1;
+    if (!is_received && errno != ETIMEDOUT)
+      print_with_errno_and_exit("mq_timedreceive() %s", queue->name);
+    record_queue_operation_time(&queue->maximum_receive_nanoseconds, &start_time);
+    return is_received;
+  }
+  case FRAME_QUEUE_BACKEND_RING_BUFFER:
+    return queue->ring_buffer.try_pop(frame);
+  }
+  return FALSE;
+}
+
+/**
+ * @brief Take the next available frame from the pipeline, blocking until one
+ * is available. The caller owns the frame's only reference.
+ */
+Frame *allocate_frame(FramePipeline *frame_pipeline)
+{
+  Frame *frame = dequeue_frame(&frame_pipeline->available_frame_queue);
+  __atomic_store_n(&frame->reference_count, 1, __ATOMIC_RELAXED);
+  return frame;
+}
+
+/**
+ * @brief Take an additional reference to a frame the caller already holds a
+ * reference to.
+ */
+void retain_frame(Frame *frame)
+{
+  __atomic_fetch_add(&frame->reference_count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Release a reference to a frame. Once the last reference is released,
+ * the pipeline's frame release function runs, if it has one, and the frame
+ * returns to the pipeline's available frame queue.
+ *
+ * The frame may be recaptured as soon as the reference is released, so the
+ * caller must not read it afterward.
+ */
+void release_frame(FramePipeline *frame_pipeline, Frame *frame)
+{
+  if (__atomic_sub_fetch(&frame->reference_count, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+
+  if (frame_pipeline->frame_release_function != NULL)
+    (frame_pipeline->frame_release_function)(frame_pipeline, frame);
+  enqueue_frame(&frame_pipeline->available_frame_queue, frame);
+}
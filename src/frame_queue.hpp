@@ -0,0 +1,18 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <mqueue.h>
+#include <time.h>
+#include "sequencer.hpp"
+
+void initialize_frame_queue(FrameQueue *queue, const char *name, FrameQueueBackend backend, struct mq_attr *attributes, int is_multiple_producer);
+void uninitialize_frame_queue(FrameQueue *queue);
+void enqueue_frame(FrameQueue *queue, Frame *frame);
+Frame *dequeue_frame(FrameQueue *queue);
+int try_dequeue_frame(FrameQueue *queue, Frame **frame);
+int timed_dequeue_frame(FrameQueue *queue, Frame **frame, const struct timespec *timeout);
+Frame *allocate_frame(FramePipeline *frame_pipeline);
+void retain_frame(Frame *frame);
+void release_frame(FramePipeline *frame_pipeline, Frame *frame);
+
+#endif
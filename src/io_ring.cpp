@@ -0,0 +1,169 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "io_ring.hpp"
+#include "sequencer.hpp"
+#include "utils/error.h"
+
+/**
+ * @brief Map one of an `io_uring` instance's shared regions.
+ */
+void *map_io_ring_region(IoRing *io_ring, size_t size, off_t offset)
+{
+  void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io_ring->file_descriptor, offset);
+  if (region == MAP_FAILED)
+    print_with_errno_and_exit("mmap() io_uring");
+  return region;
+}
+
+/**
+ * @brief Set up an `io_uring` instance with room for the given number of
+ * submissions, and map its queues. Returns FALSE, leaving nothing to clean
+ * up, when the kernel does not provide `io_uring`.
+ */
+int initialize_io_ring(IoRing *io_ring, unsigned int entry_count)
+{
+  struct io_uring_params parameters;
+  memset(&parameters, 0, sizeof(parameters));
+  io_ring->file_descriptor = (int)syscall(__NR_io_uring_setup, entry_count, &parameters);
+  if (io_ring->file_descriptor < 0)
+    return FALSE;
+
+  // Map the submission queue, its entries, and the completion queue.
+  io_ring->submission_ring_size = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+  io_ring->submission_ring = map_io_ring_region(io_ring, io_ring->submission_ring_size, IORING_OFF_SQ_RING);
+  io_ring->submission_entries_size = parameters.sq_entries * sizeof(struct io_uring_sqe);
+  io_ring->submission_entries = (struct io_uring_sqe *)map_io_ring_region(io_ring, io_ring->submission_entries_size, IORING_OFF_SQES);
+  io_ring->completion_ring_size = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+  io_ring->completion_ring = map_io_ring_region(io_ring, io_ring->completion_ring_size, IORING_OFF_CQ_RING);
+
+  // Locate the fields of each queue.
+  unsigned char *submission_ring = (unsigned char *)io_ring->submission_ring;
+  io_ring->submission_head = (unsigned int *)(submission_ring + parameters.sq_off.head);
+  io_ring->submission_tail = (unsigned int *)(submission_ring + parameters.sq_off.tail);
+  io_ring->submission_ring_mask = (unsigned int *)(submission_ring + parameters.sq_off.ring_mask);
+  io_ring->submission_array = (unsigned int *)(submission_ring + parameters.sq_off.array);
+  unsigned char *completion_ring = (unsigned char *)io_ring->completion_ring;
+  io_ring->completion_head = (unsigned int *)(completion_ring + parameters.cq_off.head);
+  io_ring->completion_tail = (unsigned int *)(completion_ring + parameters.cq_off.tail);
+  io_ring->completion_ring_mask = (unsigned int *)(completion_ring + parameters.cq_off.ring_mask);
+  io_ring->completion_entries = (struct io_uring_cqe *)(completion_ring + parameters.cq_off.cqes);
+
+  return TRUE;
+}
+
+/**
+ * @brief Confine the kernel worker threads that carry out the calling
+ * thread's blocking operations, such as buffered writes, to the given CPU.
+ * Those workers are forked from the calling thread and so share its
+ * scheduling policy and priority. Returns FALSE when the kernel cannot
+ * confine them.
+ */
+int set_io_ring_worker_cpu(IoRing *io_ring, int cpu)
+{
+  // Older kernels only create the calling thread's workers, which this
+  // configures, once it has submitted.
+  unsigned long long user_data;
+  submit_io_ring_nop(io_ring, 0);
+  wait_for_io_ring_completion(io_ring, &user_data);
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  return syscall(__NR_io_uring_register, io_ring->file_descriptor, IORING_REGISTER_IOWQ_AFF, &cpu_set, sizeof(cpu_set)) == 0;
+}
+
+/**
+ * @brief Unmap an `io_uring` instance's queues and close it.
+ */
+void uninitialize_io_ring(IoRing *io_ring)
+{
+  munmap(io_ring->completion_ring, io_ring->completion_ring_size);
+  munmap(io_ring->submission_entries, io_ring->submission_entries_size);
+  munmap(io_ring->submission_ring, io_ring->submission_ring_size);
+  close(io_ring->file_descriptor);
+}
+
+/**
+ * @brief Fill in the next submission queue entry with the given operation,
+ * and submit it without waiting for it to complete.
+ *
+ * The caller must not have more operations in flight than the queue has
+ * room for.
+ */
+void submit_io_ring_entry(
+    IoRing *io_ring,
+    unsigned char opcode,
+    int file_descriptor,
+    const void *buffer,
+    unsigned int length,
+    unsigned long long user_data)
+{
+  unsigned int tail = *io_ring->submission_tail;
+  unsigned int index = tail & *io_ring->submission_ring_mask;
+  struct io_uring_sqe *entry = &io_ring->submission_entries[index];
+  memset(entry, 0, sizeof(*entry));
+  entry->opcode = opcode;
+  entry->fd = file_descriptor;
+  entry->addr = (unsigned long long)buffer;
+  entry->len = length;
+  entry->user_data = user_data;
+  io_ring->submission_array[index] = index;
+
+  // Publish the entry to the kernel, and have it start the operation.
+  __atomic_store_n(io_ring->submission_tail, tail + 1, __ATOMIC_RELEASE);
+  while (syscall(__NR_io_uring_enter, io_ring->file_descriptor, 1, 0, 0, NULL, 0) < 0)
+    if (errno != EINTR)
+      print_with_errno_and_exit("io_uring_enter() submit");
+}
+
+/**
+ * @brief Submit a write of the given buffer to the start of the given file.
+ */
+void submit_io_ring_write(IoRing *io_ring, int file_descriptor, const void *buffer, unsigned int length, unsigned long long user_data)
+{
+  submit_io_ring_entry(io_ring, IORING_OP_WRITE, file_descriptor, buffer, length, user_data);
+}
+
+/**
+ * @brief Submit an operation that does nothing but complete, for waking the
+ * thread waiting for completions.
+ */
+void submit_io_ring_nop(IoRing *io_ring, unsigned long long user_data)
+{
+  submit_io_ring_entry(io_ring, IORING_OP_NOP, -1, NULL, 0, user_data);
+}
+
+/**
+ * @brief Wait for the next operation to complete, and get its user data.
+ * Returns its result, which is negative with an `errno` value on failure.
+ */
+int wait_for_io_ring_completion(IoRing *io_ring, unsigned long long *user_data)
+{
+  while (TRUE)
+  {
+    unsigned int head = *io_ring->completion_head;
+    if (head != __atomic_load_n(io_ring->completion_tail, __ATOMIC_ACQUIRE))
+    {
+      struct io_uring_cqe *entry = &io_ring->completion_entries[head & *io_ring->completion_ring_mask];
+      *user_data = entry->user_data;
+      int result = entry->res;
+      __atomic_store_n(io_ring->completion_head, head + 1, __ATOMIC_RELEASE);
+      return result;
+    }
+
+    if (syscall(__NR_io_uring_enter, io_ring->file_descriptor, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+      print_with_errno_and_exit("io_uring_enter() wait");
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+/**
+ * @brief An `io_uring` instance, set up through its system calls directly.
+ *
+ * The submission and completion queues are rings shared with the kernel, so
+ * one thread may submit while another waits for completions, but each queue
+ * must only be used by one thread at a time.
+ */
+typedef struct IoRing
+{
+  int file_descriptor;
+  void *submission_ring;
+  size_t submission_ring_size;
+  void *completion_ring;
+  size_t completion_ring_size;
+  struct io_uring_sqe *submission_entries;
+  size_t submission_entries_size;
+  unsigned int *submission_head;
+  unsigned int *submission_tail;
+  unsigned int *submission_ring_mask;
+  unsigned int *submission_array;
+  unsigned int *completion_head;
+  unsigned int *completion_tail;
+  unsigned int *completion_ring_mask;
+  struct io_uring_cqe *completion_entries;
+} IoRing;
+
+int initialize_io_ring(IoRing *io_ring, unsigned int entry_count);
+int set_io_ring_worker_cpu(IoRing *io_ring, int cpu);
+void uninitialize_io_ring(IoRing *io_ring);
+void submit_io_ring_write(IoRing *io_ring, int file_descriptor, const void *buffer, unsigned int length, unsigned long long user_data);
+void submit_io_ring_nop(IoRing *io_ring, unsigned long long user_data);
+int wait_for_io_ring_completion(IoRing *io_ring, unsigned long long *user_data);
+
+#endif
@@ -0,0 +1,552 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include "luma.hpp"
+#include "sequencer.hpp"
+#include "utils/log.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief The fastest sum of absolute differences row kernel this CPU supports,
+ * chosen by `initialize_luma_kernels()`.
+ */
+unsigned long long (*sum_absolute_differences_row)(const unsigned char *row_a, const unsigned char *row_b, int width);
+
+/**
+ * @brief A few rows of luma, small enough to stay in the L1 cache between
+ * being extracted and being compared.
+ */
+cv::Mat luma_strip_buffer, other_luma_strip_buffer;
+
+/**
+ * @brief The luma of one tile, small enough to stay in the L1 cache between
+ * being extracted and being compared. Each thread differencing tiles has its
+ * own.
+ */
+thread_local unsigned char tile_luma[FRAME_TILE_SIZE * FRAME_TILE_SIZE];
+
+/**
+ * @brief A frame being compared, tile by tile, to either the luma cache or the
+ * background model.
+ */
+typedef struct TileDifferenceJob
+{
+  Frame *frame;
+  cv::Mat *cached_luma_buffer;
+  cv::Mat *background_model_buffer;
+  int learning_rate_shift;
+  int is_recording_tile_differences;
+} TileDifferenceJob;
+
+/**
+ * @brief Copy the luma of one row of YUYV pixels, which is every even byte.
+ */
+void extract_luma_from_yuyv_row(const unsigned char *yuyv_row, unsigned char *luma_row, int width)
+{
+  int column = 0;
+
+#if defined(__x86_64__)
+  // Mask off the chroma of 16 pixels, and pack their luma into 16 bytes.
+  const __m128i luma_mask = _mm_set1_epi16(0x00FF);
+  for (; column + 16 <= width; column += 16)
+  {
+    __m128i low_pixels = _mm_loadu_si128((const __m128i *)(yuyv_row + 2 * column));
+    __m128i high_pixels = _mm_loadu_si128((const __m128i *)(yuyv_row + 2 * column + 16));
+    __m128i luma = _mm_packus_epi16(_mm_and_si128(low_pixels, luma_mask), _mm_and_si128(high_pixels, luma_mask));
+    _mm_storeu_si128((__m128i *)(luma_row + column), luma);
+  }
+#elif defined(__ARM_NEON)
+  // Deinterleave 16 pixels into their luma and chroma bytes.
+  for (; column + 16 <= width; column += 16)
+  {
+    uint8x16x2_t pixels = vld2q_u8(yuyv_row + 2 * column);
+    vst1q_u8(luma_row + column, pixels.val[0]);
+  }
+#endif
+
+  // Copy the remaining pixels one at a time.
+  for (; column < width; ++column)
+    luma_row[column] = yuyv_row[2 * column];
+}
+
+/**
+ * @brief Copy the luma plane out of a YUYV frame buffer, one row at a time,
+ * since a driver's rows may be padded.
+ */
+void extract_luma_from_yuyv(const cv::Mat &yuyv_frame_buffer, cv::Mat &luma_buffer)
+{
+  for (int row = 0; row < yuyv_frame_buffer.rows; ++row)
+    extract_luma_from_yuyv_row(yuyv_frame_buffer.ptr(row), luma_buffer.ptr(row), yuyv_frame_buffer.cols);
+}
+
+/**
+ * @brief Sum the absolute differences between two rows of bytes, one byte at
+ * a time.
+ */
+unsigned long long sum_absolute_differences_row_scalar(const unsigned char *row_a, const unsigned char *row_b, int width)
+{
+  unsigned long long sum = 0;
+  for (int column = 0; column < width; ++column)
+    sum += abs(row_a[column] - row_b[column]);
+  return sum;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Sum the absolute differences between two rows of bytes, 16 bytes at
+ * a time.
+ */
+unsigned long long sum_absolute_differences_row_sse2(const unsigned char *row_a, const unsigned char *row_b, int width)
+{
+  // Each SAD yields two 64-bit partial sums, accumulated lane by lane.
+  __m128i sums = _mm_setzero_si128();
+  int column = 0;
+  for (; column + 16 <= width; column += 16)
+  {
+    __m128i bytes_a = _mm_loadu_si128((const __m128i *)(row_a + column));
+    __m128i bytes_b = _mm_loadu_si128((const __m128i *)(row_b + column));
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes_a, bytes_b));
+  }
+  unsigned long long sum = _mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+
+  return sum + sum_absolute_differences_row_scalar(row_a + column, row_b + column, width - column);
+}
+
+/**
+ * @brief Sum the absolute differences between two rows of bytes, 32 bytes at
+ * a time.
+ */
+__attribute__((target("avx2"))) unsigned long long sum_absolute_differences_row_avx2(const unsigned char *row_a, const unsigned char *row_b, int width)
+{
+  // Each SAD yields four 64-bit partial sums, accumulated lane by lane.
+  __m256i sums = _mm256_setzero_si256();
+  int column = 0;
+  for (; column + 32 <= width; column += 32)
+  {
+    __m256i bytes_a = _mm256_loadu_si256((const __m256i *)(row_a + column));
+    __m256i bytes_b = _mm256_loadu_si256((const __m256i *)(row_b + column));
+    sums = _mm256_add_epi64(sums, _mm256_sad_epu8(bytes_a, bytes_b));
+  }
+  __m128i half_sums = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+  unsigned long long sum = _mm_cvtsi128_si64(half_sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(half_sums, half_sums));
+
+  return sum + sum_absolute_differences_row_sse2(row_a + column, row_b + column, width - column);
+}
+#elif defined(__ARM_NEON)
+/**
+ * @brief Sum the absolute differences between two rows of bytes, 16 bytes at
+ * a time.
+ */
+unsigned long long sum_absolute_differences_row_neon(const unsigned char *row_a, const unsigned char *row_b, int width)
+{
+  // Widen each 16 byte difference pairwise into four 32-bit partial sums.
+  uint32x4_t sums = vdupq_n_u32(0);
+  int column = 0;
+  for (; column + 16 <= width; column += 16)
+  {
+    uint8x16_t differences = vabdq_u8(vld1q_u8(row_a + column), vld1q_u8(row_b + column));
+    sums = vpadalq_u16(sums, vpaddlq_u8(differences));
+  }
+  uint64x2_t wide_sums = vpaddlq_u32(sums);
+  unsigned long long sum = vgetq_lane_u64(wide_sums, 0) + vgetq_lane_u64(wide_sums, 1);
+
+  return sum + sum_absolute_differences_row_scalar(row_a + column, row_b + column, width - column);
+}
+#endif
+
+/**
+ * @brief Sum the absolute differences between a row of luma and a row of the
+ * background model, and move the model toward the luma by the learning rate.
+ *
+ * The model holds each pixel's luma in fixed point, with
+ * `BACKGROUND_MODEL_FRACTION_BITS` fractional bits, so that small learning
+ * rates still move it. Each update adds the model's difference from the luma,
+ * shifted right by `learning_rate_shift`, so a shift of zero replaces the
+ * model with the luma.
+ */
+unsigned long long difference_and_update_background_row(
+    const unsigned char *luma_row,
+    short *background_row,
+    int width,
+    int learning_rate_shift)
+{
+  unsigned long long sum = 0;
+  int column = 0;
+
+#if defined(__x86_64__)
+  // Work on 16 pixels at a time, widened to 16 bits.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rounding = _mm_set1_epi16(1 << (BACKGROUND_MODEL_FRACTION_BITS - 1));
+  const __m128i shift = _mm_cvtsi32_si128(learning_rate_shift);
+  __m128i sums = _mm_setzero_si128();
+  for (; column + 16 <= width; column += 16)
+  {
+    __m128i luma = _mm_loadu_si128((const __m128i *)(luma_row + column));
+    __m128i low_background = _mm_loadu_si128((const __m128i *)(background_row + column));
+    __m128i high_background = _mm_loadu_si128((const __m128i *)(background_row + column + 8));
+
+    // Round the model back to whole luma levels, and compare.
+    __m128i background_luma = _mm_packus_epi16(
+        _mm_srli_epi16(_mm_add_epi16(low_background, rounding), BACKGROUND_MODEL_FRACTION_BITS),
+        _mm_srli_epi16(_mm_add_epi16(high_background, rounding), BACKGROUND_MODEL_FRACTION_BITS));
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(luma, background_luma));
+
+    // Move the model toward the luma.
+    __m128i low_luma = _mm_slli_epi16(_mm_unpacklo_epi8(luma, zero), BACKGROUND_MODEL_FRACTION_BITS);
+    __m128i high_luma = _mm_slli_epi16(_mm_unpackhi_epi8(luma, zero), BACKGROUND_MODEL_FRACTION_BITS);
+    low_background = _mm_add_epi16(low_background, _mm_sra_epi16(_mm_sub_epi16(low_luma, low_background), shift));
+    high_background = _mm_add_epi16(high_background, _mm_sra_epi16(_mm_sub_epi16(high_luma, high_background), shift));
+    _mm_storeu_si128((__m128i *)(background_row + column), low_background);
+    _mm_storeu_si128((__m128i *)(background_row + column + 8), high_background);
+  }
+  sum = _mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+#elif defined(__ARM_NEON)
+  // Work on 8 pixels at a time, widened to 16 bits.
+  const int16x8_t shift = vdupq_n_s16(-learning_rate_shift);
+  uint32x4_t sums = vdupq_n_u32(0);
+  for (; column + 8 <= width; column += 8)
+  {
+    uint8x8_t luma = vld1_u8(luma_row + column);
+    int16x8_t background = vld1q_s16(background_row + column);
+
+    // Round the model back to whole luma levels, and compare.
+    uint8x8_t background_luma = vqrshrun_n_s16(background, BACKGROUND_MODEL_FRACTION_BITS);
+    sums = vpadalq_u16(sums, vabdl_u8(luma, background_luma));
+
+    // Move the model toward the luma.
+    int16x8_t wide_luma = vreinterpretq_s16_u16(vshll_n_u8(luma, BACKGROUND_MODEL_FRACTION_BITS));
+    background = vaddq_s16(background, vshlq_s16(vsubq_s16(wide_luma, background), shift));
+    vst1q_s16(background_row + column, background);
+  }
+  uint64x2_t wide_sums = vpaddlq_u32(sums);
+  sum = vgetq_lane_u64(wide_sums, 0) + vgetq_lane_u64(wide_sums, 1);
+#endif
+
+  // Handle the remaining pixels one at a time.
+  for (; column < width; ++column)
+  {
+    int background_luma = (background_row[column] + (1 << (BACKGROUND_MODEL_FRACTION_BITS - 1))) >> BACKGROUND_MODEL_FRACTION_BITS;
+    sum += abs(luma_row[column] - background_luma);
+    int wide_luma = luma_row[column] << BACKGROUND_MODEL_FRACTION_BITS;
+    background_row[column] += (wide_luma - background_row[column]) >> learning_rate_shift;
+  }
+
+  return sum;
+}
+
+/**
+ * @brief Choose the fastest row kernels this CPU supports.
+ */
+void initialize_luma_kernels()
+{
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+  {
+    sum_absolute_differences_row = sum_absolute_differences_row_avx2;
+    write_log("Luma Kernels: AVX2");
+  }
+  else
+  {
+    sum_absolute_differences_row = sum_absolute_differences_row_sse2;
+    write_log("Luma Kernels: SSE2");
+  }
+#elif defined(__ARM_NEON)
+  sum_absolute_differences_row = sum_absolute_differences_row_neon;
+  write_log("Luma Kernels: NEON");
+#else
+  sum_absolute_differences_row = sum_absolute_differences_row_scalar;
+  write_log("Luma Kernels: Scalar");
+#endif
+}
+
+/**
+ * @brief Sum the absolute differences between two sampled luma buffers of the
+ * same size, tile by tile, without storing the differences.
+ *
+ * Each tile of the frame's map gets its sampled sum scaled up by the number of
+ * pixels each sample stands for, as an estimate of the tile's full sum.
+ * Returns the unscaled sum of every sample.
+ */
+unsigned long long difference_sampled_luma_by_tile(
+    const cv::Mat &previous_sampled_luma_buffer,
+    const cv::Mat &sampled_luma_buffer,
+    int decimation,
+    Frame *frame)
+{
+  int tile_samples = FRAME_TILE_SIZE / decimation;
+  int first_tile_row = frame->region_of_interest.y / FRAME_TILE_SIZE;
+  int first_tile_column = frame->region_of_interest.x / FRAME_TILE_SIZE;
+  frame->tile_difference_map.setTo(cv::Scalar(0));
+
+  unsigned long long sum = 0;
+  for (int row = 0; row < sampled_luma_buffer.rows; ++row)
+  {
+    const unsigned char *previous_row = previous_sampled_luma_buffer.ptr(row);
+    const unsigned char *current_row = sampled_luma_buffer.ptr(row);
+    unsigned int *tile_differences = frame->tile_difference_map.ptr<unsigned int>(first_tile_row + row / tile_samples) + first_tile_column;
+    for (int first_column = 0; first_column < sampled_luma_buffer.cols; first_column += tile_samples)
+    {
+      int column_count = std::min(tile_samples, sampled_luma_buffer.cols - first_column);
+      unsigned long long tile_sum = sum_absolute_differences_row(previous_row + first_column, current_row + first_column, column_count);
+      tile_differences[first_column / tile_samples] += tile_sum * decimation * decimation;
+      sum += tile_sum;
+    }
+  }
+
+  return sum;
+}
+
+/**
+ * @brief Get the luma of a region of a frame, extracting it into the given
+ * luma buffer of the region's size unless the frame is already GREY.
+ */
+cv::Mat get_luma_region(Frame *frame, const cv::Rect &region, cv::Mat luma_region)
+{
+  cv::Mat color_region = frame->frame_buffer(region);
+  if (frame->format == FRAME_FORMAT_GREY)
+    return color_region;
+
+  if (frame->format == FRAME_FORMAT_BGR)
+    cv::cvtColor(color_region, luma_region, CV_BGR2GRAY);
+  else
+    extract_luma_from_yuyv(color_region, luma_region);
+  return luma_region;
+}
+
+/**
+ * @brief Get the number of tiles spanned by a length of pixels.
+ */
+int get_tile_count(int length)
+{
+  return (length + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE;
+}
+
+/**
+ * @brief Compare one tile of a frame's region of interest to the same tile of
+ * the luma cache, replace the cached tile with the frame's, and record the
+ * tile's sum of absolute luma differences in the frame's tile difference map.
+ */
+void difference_tile(void *job_context, int tile_index)
+{
+  TileDifferenceJob *job = (TileDifferenceJob *)job_context;
+  Frame *frame = job->frame;
+  cv::Mat *cached_luma_buffer = job->cached_luma_buffer;
+  const cv::Rect &region_of_interest = frame->region_of_interest;
+
+  // Locate the tile, which is smaller at the region's bottom and right edges.
+  int region_tile_columns = get_tile_count(region_of_interest.width);
+  int tile_row = region_of_interest.y / FRAME_TILE_SIZE + tile_index / region_tile_columns;
+  int tile_column = region_of_interest.x / FRAME_TILE_SIZE + tile_index % region_tile_columns;
+  cv::Rect region(
+      tile_column * FRAME_TILE_SIZE,
+      tile_row * FRAME_TILE_SIZE,
+      std::min(FRAME_TILE_SIZE, region_of_interest.x + region_of_interest.width - tile_column * FRAME_TILE_SIZE),
+      std::min(FRAME_TILE_SIZE, region_of_interest.y + region_of_interest.height - tile_row * FRAME_TILE_SIZE));
+  cv::Mat luma_tile = get_luma_region(frame, region, cv::Mat(region.height, region.width, CV_8UC1, tile_luma));
+
+  unsigned long long sum = 0;
+  for (int row = 0; row < region.height; ++row)
+  {
+    const unsigned char *luma_row = luma_tile.ptr(row);
+    if (job->background_model_buffer != NULL)
+    {
+      short *background_row = job->background_model_buffer->ptr<short>(region.y + row) + region.x;
+      sum += difference_and_update_background_row(luma_row, background_row, region.width, job->learning_rate_shift);
+    }
+    else
+    {
+      unsigned char *cached_luma_row = cached_luma_buffer->ptr(region.y + row) + region.x;
+      sum += sum_absolute_differences_row(cached_luma_row, luma_row, region.width);
+      memcpy(cached_luma_row, luma_row, region.width);
+    }
+  }
+  if (job->is_recording_tile_differences)
+    frame->tile_difference_map.ptr<unsigned int>(tile_row)[tile_column] = (unsigned int)sum;
+}
+
+/**
+ * @brief Run a tile difference job over the frame's region of interest, and
+ * sum its tiles' differences.
+ */
+unsigned long long run_tile_difference_job(TileDifferenceJob *job, WorkerPool *worker_pool)
+{
+  Frame *frame = job->frame;
+  int tile_count = get_tile_count(frame->region_of_interest.width) * get_tile_count(frame->region_of_interest.height);
+  if (job->is_recording_tile_differences)
+    frame->tile_difference_map.setTo(cv::Scalar(0));
+  run_worker_pool_job(worker_pool, difference_tile, job, tile_count);
+
+  unsigned long long sum = 0;
+  for (int tile_row = 0; tile_row < frame->tile_difference_map.rows; ++tile_row)
+    for (int tile_column = 0; tile_column < frame->tile_difference_map.cols; ++tile_column)
+      sum += frame->tile_difference_map.ptr<unsigned int>(tile_row)[tile_column];
+  return sum;
+}
+
+/**
+ * @brief Compare a frame's region of interest to the luma of the previous
+ * frame, and replace that luma with the frame's own, in a single pass. Returns
+ * the sum of absolute luma differences, and fills in the frame's tile
+ * difference map.
+ *
+ * The region is processed a `FRAME_TILE_SIZE` tile at a time, in parallel
+ * across the worker pool. Each tile's luma is compared while still in the L1
+ * cache and never written out in full. The frame buffer is left intact, and
+ * its luma buffer is not filled in.
+ */
+unsigned long long difference_frame_against_luma_cache(Frame *frame, cv::Mat &cached_luma_buffer, WorkerPool *worker_pool)
+{
+  TileDifferenceJob job = {
+      .frame = frame,
+      .cached_luma_buffer = &cached_luma_buffer,
+      .background_model_buffer = NULL,
+      .learning_rate_shift = 0,
+      .is_recording_tile_differences = TRUE,
+  };
+  return run_tile_difference_job(&job, worker_pool);
+}
+
+/**
+ * @brief Compare a frame's region of interest to the background model, and
+ * move the model toward the frame by the learning rate, in a single pass.
+ * Returns the sum of absolute luma differences, and fills in the frame's tile
+ * difference map.
+ *
+ * Like the luma cache, the region is processed a tile at a time in parallel
+ * across the worker pool, and the frame buffer is left intact.
+ */
+unsigned long long difference_frame_against_background_model(
+    Frame *frame,
+    cv::Mat &background_model_buffer,
+    int learning_rate_shift,
+    WorkerPool *worker_pool)
+{
+  TileDifferenceJob job = {
+      .frame = frame,
+      .cached_luma_buffer = NULL,
+      .background_model_buffer = &background_model_buffer,
+      .learning_rate_shift = learning_rate_shift,
+      .is_recording_tile_differences = TRUE,
+  };
+  return run_tile_difference_job(&job, worker_pool);
+}
+
+/**
+ * @brief Replace the background model with a frame's luma over its region of
+ * interest, leaving the frame's tile difference map as it is.
+ */
+void reset_background_model(Frame *frame, cv::Mat &background_model_buffer, WorkerPool *worker_pool)
+{
+  TileDifferenceJob job = {
+      .frame = frame,
+      .cached_luma_buffer = NULL,
+      .background_model_buffer = &background_model_buffer,
+      .learning_rate_shift = 0,
+      .is_recording_tile_differences = FALSE,
+  };
+  run_tile_difference_job(&job, worker_pool);
+}
+
+/**
+ * @brief Sample the luma of every `decimation`th pixel of every `decimation`th
+ * row of a frame's region of interest into the given buffer.
+ *
+ * Only the sampled pixels are converted, using OpenCV's fixed-point BT.601
+ * weights for BGR, so the skipped rows are never read at all.
+ */
+void sample_frame_luma(Frame *frame, cv::Mat &sampled_luma_buffer, int decimation)
+{
+  const cv::Rect &region_of_interest = frame->region_of_interest;
+  sampled_luma_buffer.create(region_of_interest.height / decimation, region_of_interest.width / decimation, CV_8UC1);
+  for (int row = 0; row < sampled_luma_buffer.rows; ++row)
+  {
+    const unsigned char *frame_row = frame->frame_buffer.ptr(region_of_interest.y + row * decimation);
+    unsigned char *sampled_luma_row = sampled_luma_buffer.ptr(row);
+    for (int column = 0; column < sampled_luma_buffer.cols; ++column)
+    {
+      int frame_column = region_of_interest.x + column * decimation;
+      switch (frame->format)
+      {
+      case FRAME_FORMAT_BGR:
+      {
+        const unsigned char *pixel = frame_row + 3 * frame_column;
+        sampled_luma_row[column] = (pixel[0] * 1868 + pixel[1] * 9617 + pixel[2] * 4899 + (1 << 13)) >> 14;
+        break;
+      }
+      case FRAME_FORMAT_YUYV:
+        sampled_luma_row[column] = frame_row[2 * frame_column];
+        break;
+      case FRAME_FORMAT_GREY:
+        sampled_luma_row[column] = frame_row[frame_column];
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Sum the absolute luma differences between two frames at full
+ * resolution over the second frame's region of interest, a strip of rows at a
+ * time, without storing either luma.
+ *
+ * Stops early, returning a partial sum greater than `limit`, as soon as the
+ * sum is known to exceed it.
+ */
+unsigned long long difference_frames(Frame *frame_a, Frame *frame_b, unsigned long long limit)
+{
+  const cv::Rect &region_of_interest = frame_b->region_of_interest;
+  int columns = region_of_interest.width;
+  luma_strip_buffer.create(LUMA_STRIP_ROWS, columns, CV_8UC1);
+  other_luma_strip_buffer.create(LUMA_STRIP_ROWS, columns, CV_8UC1);
+
+  unsigned long long sum = 0;
+  for (int row_offset = 0; row_offset < region_of_interest.height && sum <= limit; row_offset += LUMA_STRIP_ROWS)
+  {
+    int row_count = std::min(LUMA_STRIP_ROWS, region_of_interest.height - row_offset);
+    cv::Rect region(region_of_interest.x, region_of_interest.y + row_offset, columns, row_count);
+    cv::Mat luma_strip_a = get_luma_region(frame_a, region, luma_strip_buffer.rowRange(0, row_count));
+    cv::Mat luma_strip_b = get_luma_region(frame_b, region, other_luma_strip_buffer.rowRange(0, row_count));
+    for (int row = 0; row < row_count; ++row)
+      sum += sum_absolute_differences_row(luma_strip_a.ptr(row), luma_strip_b.ptr(row), columns);
+  }
+
+  return sum;
+}
+
+/**
+ * @brief Extract the luma of a frame into its luma buffer, leaving the frame
+ * buffer intact.
+ *
+ * YUYV frames already carry their luma, so it is copied out directly rather
+ * than converted. A GREY frame is its own luma, so its luma buffer simply
+ * points at its frame buffer.
+ */
+void convert_frame_to_luma(Frame *frame)
+{
+  switch (frame->format)
+  {
+  case FRAME_FORMAT_BGR:
+    cv::cvtColor(frame->frame_buffer, frame->luma_buffer, CV_BGR2GRAY);
+    break;
+  case FRAME_FORMAT_YUYV:
+    extract_luma_from_yuyv(frame->frame_buffer, frame->luma_buffer);
+    break;
+  case FRAME_FORMAT_GREY:
+    frame->luma_buffer = frame->frame_buffer;
+    break;
+  }
+}
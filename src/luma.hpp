@@ -0,0 +1,30 @@
+#ifndef LUMA_H
+#define LUMA_H
+
+#include <opencv2/core.hpp>
+#include "sequencer.hpp"
+#include "worker_pool.hpp"
+
+#define LUMA_STRIP_ROWS (16)
+#define BACKGROUND_MODEL_FRACTION_BITS (7)
+
+void extract_luma_from_yuyv(const cv::Mat &yuyv_frame_buffer, cv::Mat &luma_buffer);
+cv::Mat get_luma_region(Frame *frame, const cv::Rect &region, cv::Mat luma_region);
+void convert_frame_to_luma(Frame *frame);
+void initialize_luma_kernels();
+unsigned long long difference_frame_against_luma_cache(Frame *frame, cv::Mat &cached_luma_buffer, WorkerPool *worker_pool);
+unsigned long long difference_frame_against_background_model(
+    Frame *frame,
+    cv::Mat &background_model_buffer,
+    int learning_rate_shift,
+    WorkerPool *worker_pool);
+void reset_background_model(Frame *frame, cv::Mat &background_model_buffer, WorkerPool *worker_pool);
+unsigned long long difference_sampled_luma_by_tile(
+    const cv::Mat &previous_sampled_luma_buffer,
+    const cv::Mat &sampled_luma_buffer,
+    int decimation,
+    Frame *frame);
+void sample_frame_luma(Frame *frame, cv::Mat &sampled_luma_buffer, int decimation);
+unsigned long long difference_frames(Frame *frame_a, Frame *frame_b, unsigned long long limit);
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#include "luma.hpp"
+#include "region_of_interest.hpp"
+#include "sequencer.hpp"
+#include "worker_pool.hpp"
+#include "utils/error.h"
+#include "utils/log.h"
+
+/**
+ * @brief Grow a region outward to the tile grid, and clip it to the frame.
+ */
+cv::Rect align_region_to_tiles(const cv::Rect &region, int rows, int columns)
+{
+  int left = std::max(0, region.x) / FRAME_TILE_SIZE * FRAME_TILE_SIZE;
+  int top = std::max(0, region.y) / FRAME_TILE_SIZE * FRAME_TILE_SIZE;
+  int right = std::min(columns, (region.x + region.width + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE * FRAME_TILE_SIZE);
+  int bottom = std::min(rows, (region.y + region.height + FRAME_TILE_SIZE - 1) / FRAME_TILE_SIZE * FRAME_TILE_SIZE);
+  return cv::Rect(left, top, right - left, bottom - top);
+}
+
+/**
+ * @brief Locate the clock face in a frame's luma, as the largest circle found
+ * by a Hough transform. Returns `TRUE` and the face's tile-aligned bounding
+ * box, with a margin, if a face was found.
+ *
+ * The search runs on a downscaled copy of the luma.
+ */
+int detect_clock_face(const cv::Mat &luma_buffer, cv::Rect *clock_face_region)
+{
+  // Downscale and smooth the luma, to speed up the search and suppress
+  // spurious edges.
+  cv::Mat search_buffer;
+  cv::resize(luma_buffer, search_buffer, cv::Size(), CLOCK_FACE_DETECTION_SCALE, CLOCK_FACE_DETECTION_SCALE, cv::INTER_AREA);
+  cv::GaussianBlur(search_buffer, search_buffer, cv::Size(9, 9), 2);
+
+  // Search for circles at least a quarter of the frame's height across.
+  std::vector<cv::Vec3f> circles;
+  cv::HoughCircles(
+      search_buffer,
+      circles,
+      cv::HOUGH_GRADIENT,
+      1,
+      search_buffer.rows / 2,
+      100,
+      40,
+      search_buffer.rows / 8,
+      search_buffer.rows / 2);
+  if (circles.empty())
+    return FALSE;
+
+  // Take the largest circle as the clock face.
+  cv::Vec3f face = circles[0];
+  for (const cv::Vec3f &circle : circles)
+    if (circle[2] > face[2])
+      face = circle;
+
+  // Bound it, with a margin, in full-resolution pixels.
+  double radius = face[2] / CLOCK_FACE_DETECTION_SCALE * (1.0 + CLOCK_FACE_MARGIN);
+  double center_x = face[0] / CLOCK_FACE_DETECTION_SCALE;
+  double center_y = face[1] / CLOCK_FACE_DETECTION_SCALE;
+  *clock_face_region = align_region_to_tiles(
+      cv::Rect((int)floor(center_x - radius), (int)floor(center_y - radius), (int)ceil(2 * radius), (int)ceil(2 * radius)),
+      luma_buffer.rows,
+      luma_buffer.cols);
+  return TRUE;
+}
+
+/**
+ * @brief A thread entry point, for use with `pthread_create()`. Searches for
+ * the clock face each time a search is requested, until told to exit.
+ */
+void *RegionDetectorThread(void *thread_parameters)
+{
+  RegionDetector *region_detector = (RegionDetector *)thread_parameters;
+
+  while (TRUE)
+  {
+    attempt(sem_wait(&region_detector->request_semaphore), "sem_wait()");
+    if (region_detector->exit_flag)
+      break;
+
+    int is_found = detect_clock_face(region_detector->luma_buffer, &region_detector->region);
+    region_detector->state.store(
+        is_found ? REGION_DETECTION_STATE_FOUND : REGION_DETECTION_STATE_NOT_FOUND,
+        std::memory_order_release);
+  }
+
+  return (void *)0;
+}
+
+/**
+ * @brief Start a region detector for frames of the given size, on the given
+ * CPU.
+ */
+void initialize_region_detector(RegionDetector *region_detector, int rows, int columns, int cpu)
+{
+  region_detector->luma_buffer.create(rows, columns, CV_8UC1);
+  region_detector->exit_flag = FALSE;
+  region_detector->state.store(REGION_DETECTION_STATE_IDLE);
+  attempt(sem_init(&region_detector->request_semaphore, 0, 0), "sem_init()");
+  start_background_thread(&region_detector->thread, cpu, RegionDetectorThread, (void *)region_detector);
+  write_log("Region Detector: CPU: %i", cpu);
+}
+
+/**
+ * @brief Stop a region detector, waiting for any search in progress.
+ */
+void uninitialize_region_detector(RegionDetector *region_detector)
+{
+  region_detector->exit_flag = TRUE;
+  sem_post(&region_detector->request_semaphore);
+  errno = pthread_join(region_detector->thread, NULL);
+  if (errno)
+    print_with_errno_and_exit("pthread_join()");
+  sem_destroy(&region_detector->request_semaphore);
+  region_detector->luma_buffer.release();
+}
+
+/**
+ * @brief Start a search of the given frame for the clock face, unless a
+ * search is already in progress or its result has not been collected.
+ * Returns `TRUE` if a search was started.
+ *
+ * Only the frame's luma is copied, so the frame may be released at once.
+ */
+int request_region_detection(RegionDetector *region_detector, Frame *frame)
+{
+  if (region_detector->state.load(std::memory_order_acquire) != REGION_DETECTION_STATE_IDLE)
+    return FALSE;
+
+  convert_frame_to_luma(frame);
+  frame->luma_buffer.copyTo(region_detector->luma_buffer);
+  region_detector->state.store(REGION_DETECTION_STATE_SEARCHING, std::memory_order_release);
+  attempt(sem_post(&region_detector->request_semaphore), "sem_post()");
+  return TRUE;
+}
+
+/**
+ * @brief Collect the result of a finished search, leaving the detector idle.
+ * Returns the search's state, and the region found, if any.
+ */
+RegionDetectionState get_region_detection_result(RegionDetector *region_detector, cv::Rect *region)
+{
+  RegionDetectionState state = (RegionDetectionState)region_detector->state.load(std::memory_order_acquire);
+  if (state == REGION_DETECTION_STATE_FOUND)
+    *region = region_detector->region;
+  if (state == REGION_DETECTION_STATE_FOUND || state == REGION_DETECTION_STATE_NOT_FOUND)
+    region_detector->state.store(REGION_DETECTION_STATE_IDLE, std::memory_order_release);
+  return state;
+}
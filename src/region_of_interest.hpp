@@ -0,0 +1,49 @@
+#ifndef REGION_OF_INTEREST_H
+#define REGION_OF_INTEREST_H
+
+#include <atomic>
+#include <opencv2/core.hpp>
+#include <pthread.h>
+#include <semaphore.h>
+#include "sequencer.hpp"
+
+#define CLOCK_FACE_DETECTION_SCALE (0.5)
+#define CLOCK_FACE_MARGIN (0.1)
+
+/**
+ * @brief The progress of a region detector's current search.
+ */
+typedef enum RegionDetectionState
+{
+  REGION_DETECTION_STATE_IDLE,
+  REGION_DETECTION_STATE_SEARCHING,
+  REGION_DETECTION_STATE_FOUND,
+  REGION_DETECTION_STATE_NOT_FOUND,
+} RegionDetectionState;
+
+/**
+ * @brief A normal priority thread that searches a copy of a frame's luma for
+ * the clock face, so that the search never runs on a real-time service.
+ *
+ * The service requesting a search owns the luma buffer and the region while
+ * the detector is idle or has finished, and the detector owns them while it
+ * is searching. The state hands them back and forth.
+ */
+typedef struct RegionDetector
+{
+  pthread_t thread;
+  sem_t request_semaphore;
+  std::atomic<int> state;
+  int exit_flag;
+  cv::Mat luma_buffer;
+  cv::Rect region;
+} RegionDetector;
+
+cv::Rect align_region_to_tiles(const cv::Rect &region, int rows, int columns);
+int detect_clock_face(const cv::Mat &luma_buffer, cv::Rect *clock_face_region);
+void initialize_region_detector(RegionDetector *region_detector, int rows, int columns, int cpu);
+void uninitialize_region_detector(RegionDetector *region_detector);
+int request_region_detection(RegionDetector *region_detector, Frame *frame);
+RegionDetectionState get_region_detection_result(RegionDetector *region_detector, cv::Rect *region);
+
+#endif
@@ -0,0 +1,317 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "schedulability.hpp"
+#include "sequencer.hpp"
+#include "utils/error.h"
+#include "utils/histogram.h"
+#include "utils/log.h"
+#include "utils/time.h"
+
+#define SEQUENCER_ID (0)
+#define CRITICAL_SECTION_ID (1000)
+
+/**
+ * @brief Load the WCETs measured by a previous run into the schedule. Returns
+ * `TRUE` if a measurement was found for the sequencer, every service, and the
+ * longest critical section.
+ *
+ * Each line of the file is `id,wcet_nanoseconds`, where the sequencer has the
+ * id `SEQUENCER_ID` and the longest critical section has the id
+ * `CRITICAL_SECTION_ID`.
+ */
+int load_measured_wcets(Schedule *schedule, const char *filename)
+{
+  FILE *file = fopen(filename, "r");
+  if (file == NULL)
+    return FALSE;
+
+  int found_count = 0;
+  unsigned int id;
+  long long wcet_nanoseconds;
+  while (fscanf(file, "%u,%lld", &id, &wcet_nanoseconds) == 2)
+  {
+    if (id == SEQUENCER_ID)
+    {
+      schedule->sequencer_wcet_nanoseconds = wcet_nanoseconds;
+      ++found_count;
+    }
+    if (id == CRITICAL_SECTION_ID)
+    {
+      schedule->critical_section_nanoseconds = wcet_nanoseconds;
+      ++found_count;
+    }
+    for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+      if (schedule->services[index].id == id)
+      {
+        schedule->services[index].wcet_nanoseconds = wcet_nanoseconds;
+        ++found_count;
+      }
+  }
+  fclose(file);
+
+  return found_count == NUMBER_OF_SERVICES + 2;
+}
+
+/**
+ * @brief Get the WCET of a service measured during this run. Prefers the time
+ * the service spent working, which excludes time blocked on its queues, and
+ * falls back to its whole execution time if it never stamped its work timer.
+ */
+long long get_measured_wcet(Service *service)
+{
+  if (get_histogram_count(&service->work_time_histogram) > 0)
+    return get_histogram_maximum(&service->work_time_histogram);
+  return get_histogram_maximum(&service->execution_time_histogram);
+}
+
+/**
+ * @brief Get the longest time a service held a lock shared with the other
+ * services during this run. Covers the tick tracker's priority-inheritance
+ * mutex, and the frame queues' locks: the message queues' kernel locks when
+ * they are the backend, or the producer mutex of a ring buffer shared by
+ * several producers. A single-producer ring buffer holds no lock.
+ */
+long long get_longest_critical_section(FramePipeline *frame_pipeline)
+{
+  long long critical_section_nanoseconds = frame_pipeline->tick_tracker.maximum_critical_section_nanoseconds;
+  FrameQueue *queues[] = {
+      &frame_pipeline->available_frame_queue,
+      &frame_pipeline->captured_frame_queue,
+      &frame_pipeline->difference_frame_queue,
+      &frame_pipeline->selected_frame_queue,
+  };
+  for (FrameQueue *queue : queues)
+  {
+    if (queue->maximum_send_nanoseconds > critical_section_nanoseconds)
+      critical_section_nanoseconds = queue->maximum_send_nanoseconds;
+    if (queue->maximum_receive_nanoseconds > critical_section_nanoseconds)
+      critical_section_nanoseconds = queue->maximum_receive_nanoseconds;
+  }
+  return critical_section_nanoseconds;
+}
+
+/**
+ * @brief Save the WCETs and longest critical section measured during this
+ * run, for analysis of the next.
+ */
+void save_measured_wcets(Schedule *schedule, const char *filename)
+{
+  FILE *file = fopen(filename, "w");
+  if (file == NULL)
+    print_with_errno_and_exit("fopen() %s", filename);
+
+  fprintf(file, "%u,%llu\n", SEQUENCER_ID, get_histogram_maximum(&schedule->sequencer_histogram));
+  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+  {
+    Service *service = &schedule->services[index];
+    fprintf(file, "%u,%lld\n", service->id, get_measured_wcet(service));
+  }
+  fprintf(file, "%u,%lld\n", CRITICAL_SECTION_ID, schedule->critical_section_nanoseconds);
+
+  attempt(fclose(file), "fclose() %s", filename);
+}
+
+/**
+ * @brief Determine whether the sequencer competes for the given CPU. A
+ * sequencer thread only runs on its own CPU, but a signal handler may run on
+ * any of them.
+ */
+int is_sequencer_on_cpu(Schedule *schedule, int cpu)
+{
+  return schedule->sequencer_mode == SEQUENCER_MODE_SIGNAL || schedule->sequencer_cpu == cpu;
+}
+
+/**
+ * @brief Calculate the worst-case response time of a service using exact
+ * response-time analysis, including interference from higher-priority
+ * services and the sequencer on the same CPU, and blocking from lower-priority
+ * services holding a shared lock. Stops early once the response time exceeds
+ * the deadline.
+ */
+long long get_worst_case_response_time(Schedule *schedule, Service *service, long long tick_nanoseconds)
+{
+  // Each lower-priority service on the same CPU may block this one once per
+  // request, for up to the longest critical section measured, since the
+  // shared locks either inherit priority or are kernel locks that are never
+  // preempted.
+  long long blocking = 0;
+  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+  {
+    Service *other = &schedule->services[index];
+    if (other->cpu == service->cpu && other->priority_descending > service->priority_descending)
+      blocking += schedule->critical_section_nanoseconds;
+  }
+
+  // Iterate R = C + B + sum(ceil(R / T_j) * C_j) to a fixed point.
+  long long response_time = service->wcet_nanoseconds + blocking;
+  long long previous_response_time = 0;
+  while (response_time != previous_response_time && response_time <= service->deadline_nanoseconds)
+  {
+    previous_response_time = response_time;
+    response_time = service->wcet_nanoseconds + blocking;
+
+    if (is_sequencer_on_cpu(schedule, service->cpu))
+      response_time += (long long)ceil((double)previous_response_time / tick_nanoseconds) * schedule->sequencer_wcet_nanoseconds;
+
+    for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+    {
+      Service *other = &schedule->services[index];
+      if (other->cpu != service->cpu || other->priority_descending >= service->priority_descending)
+        continue;
+      long long other_period = other->period * tick_nanoseconds;
+      response_time += (long long)ceil((double)previous_response_time / other_period) * other->wcet_nanoseconds;
+    }
+  }
+
+  return response_time;
+}
+
+/**
+ * @brief Analyze whether the `SCHED_DEADLINE` services fit within the
+ * bandwidth the kernel admits across all CPUs. Prints and logs a report, and
+ * returns `TRUE` if they fit.
+ *
+ * Under global EDF this guarantees bounded tardiness rather than every
+ * deadline. The kernel applies the same test when each service starts.
+ */
+int analyze_deadline_schedulability(Schedule *schedule)
+{
+  long long tick_nanoseconds = llround(NANOSECONDS_PER_SECOND / schedule->frequency);
+  long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  double utilization = 0;
+  printf("Schedulability Analysis (SCHED_DEADLINE), Frequency: %f Hz\n", schedule->frequency);
+  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+  {
+    Service *service = &schedule->services[index];
+    double service_utilization = (double)service->wcet_nanoseconds / (service->period * tick_nanoseconds);
+    utilization += service_utilization;
+    printf(
+        "  Service: %i (%s), WCET: %.3f ms, Utilization: %.4f\n",
+        service->id,
+        service->name,
+        (double)service->wcet_nanoseconds / NANOSECONDS_PER_MILLSECOND,
+        service_utilization);
+  }
+
+  double utilization_bound = cpu_count * DEADLINE_BANDWIDTH_LIMIT;
+  int is_schedulable = utilization <= utilization_bound;
+  printf(
+      "Utilization: %.4f, Bandwidth Limit: %.4f (%s)\n",
+      utilization,
+      utilization_bound,
+      is_schedulable ? "PASS" : "FAIL");
+  write_log(
+      "Schedulability: SCHED_DEADLINE Utilization: %.4f, Bandwidth Limit: %.4f",
+      utilization,
+      utilization_bound);
+
+  if (!is_schedulable)
+    printf("WARNING: Schedule exceeds the SCHED_DEADLINE bandwidth limit.\n");
+
+  return is_schedulable;
+}
+
+/**
+ * @brief Analyze whether each CPU's services are guaranteed to meet their
+ * deadlines under rate-monotonic or `SCHED_DEADLINE` scheduling, using the WCETs loaded into the
+ * schedule. Prints and logs a report per CPU, and returns `TRUE` if every
+ * deadline is guaranteed.
+ *
+ * Service phases are ignored, so every service is assumed to be released at
+ * the critical instant.
+ */
+int analyze_schedulability(Schedule *schedule)
+{
+  if (schedule->execution_mode == EXECUTION_MODE_DEADLINE)
+    return analyze_deadline_schedulability(schedule);
+
+  long long tick_nanoseconds = llround(NANOSECONDS_PER_SECOND / schedule->frequency);
+  int is_schedulable = TRUE;
+
+  // Find the highest CPU in use.
+  int maximum_cpu = schedule->sequencer_cpu;
+  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+    if (schedule->services[index].cpu > maximum_cpu)
+      maximum_cpu = schedule->services[index].cpu;
+
+  printf("Schedulability Analysis, Frequency: %f Hz\n", schedule->frequency);
+  for (int cpu = 0; cpu <= maximum_cpu; ++cpu)
+  {
+    // Sum the utilization of the CPU, counting the sequencer as a task.
+    int task_count = 0;
+    double utilization = 0;
+    if (is_sequencer_on_cpu(schedule, cpu))
+    {
+      ++task_count;
+      utilization += (double)schedule->sequencer_wcet_nanoseconds / tick_nanoseconds;
+    }
+    for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+    {
+      Service *service = &schedule->services[index];
+      if (service->cpu != cpu)
+        continue;
+      ++task_count;
+      utilization += (double)service->wcet_nanoseconds / (service->period * tick_nanoseconds);
+    }
+    if (task_count == 0)
+      continue;
+
+    // Compare with the Liu & Layland least upper bound, which is sufficient
+    // but not necessary.
+    double utilization_bound = task_count * (pow(2.0, 1.0 / task_count) - 1);
+    printf(
+        "CPU: %i, Utilization: %.4f, Liu & Layland Bound: %.4f (%s)\n",
+        cpu,
+        utilization,
+        utilization_bound,
+        utilization <= utilization_bound ? "PASS" : "INCONCLUSIVE");
+    write_log(
+        "Schedulability: CPU: %i, Utilization: %.4f, Liu & Layland Bound: %.4f",
+        cpu,
+        utilization,
+        utilization_bound);
+
+    // The response-time analysis is exact.
+    for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+    {
+      Service *service = &schedule->services[index];
+      if (service->cpu != cpu)
+        continue;
+
+      long long response_time = get_worst_case_response_time(schedule, service, tick_nanoseconds);
+      int meets_deadline = response_time <= service->deadline_nanoseconds;
+      if (!meets_deadline)
+        is_schedulable = FALSE;
+
+      printf(
+          "  Service: %i (%s), WCET: %.3f ms, Response Time: %.3f ms, Deadline: %.3f ms (%s)\n",
+          service->id,
+          service->name,
+          (double)service->wcet_nanoseconds / NANOSECONDS_PER_MILLSECOND,
+          (double)response_time / NANOSECONDS_PER_MILLSECOND,
+          (double)service->deadline_nanoseconds / NANOSECONDS_PER_MILLSECOND,
+          meets_deadline ? "PASS" : "FAIL");
+      write_log(
+          "Schedulability: Service: %i (%s), WCET: %lld ns, Response Time: %lld ns, Deadline: %lld ns",
+          service->id,
+          service->name,
+          service->wcet_nanoseconds,
+          response_time,
+          service->deadline_nanoseconds);
+    }
+  }
+
+  if (!is_schedulable)
+    printf("WARNING: Schedule is not guaranteed to meet its deadlines.\n");
+
+  return is_schedulable;
+}
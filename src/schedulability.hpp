@@ -0,0 +1,14 @@
+#ifndef SCHEDULABILITY_H
+#define SCHEDULABILITY_H
+
+#include "sequencer.hpp"
+
+#define WCET_FILENAME "wcet.csv"
+#define DEADLINE_BANDWIDTH_LIMIT (0.95)
+
+int load_measured_wcets(Schedule *schedule, const char *filename);
+long long get_longest_critical_section(FramePipeline *frame_pipeline);
+void save_measured_wcets(Schedule *schedule, const char *filename);
+int analyze_schedulability(Schedule *schedule);
+
+#endif
@@ -6,24 +6,67 @@
  */
 
 #include <errno.h>
+#include <math.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 #include "services/capture_frame.h"
 #include "services/difference_frame.h"
 #include "services/select_frame.h"
 #include "services/write_frame.h"
+#include "frame_arena.hpp"
+#include "frame_queue.hpp"
+#include "schedulability.hpp"
 #include "sequencer.hpp"
+#include "tick_tracker.hpp"
 #include "utils/error.h"
 #include "utils/log.h"
 #include "utils/time.h"
 
+#define DEADLINE_RUNTIME_MARGIN (1.2)
+#define DEADLINE_DEFAULT_RUNTIME_FRACTION (0.5)
+#define DEADLINE_MINIMUM_RUNTIME_NANOSECONDS (1024)
+
+#define CLOCK_MODE CLOCK_MODE_1_HZ
+#define CLOCK_TICK_FREQUENCY (CLOCK_MODE == CLOCK_MODE_10_HZ ? 10.0 : 1.0)
+#define FRAMES_PER_TICK (3)
+
+/**
+ * @brief The attributes accepted by the `sched_setattr` system call, which
+ * has no C library wrapper.
+ */
+typedef struct SchedulingAttributes
+{
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+} SchedulingAttributes;
+
 /**
  * @brief The frame pipeline resources.
  */
 FramePipeline frame_pipeline = {
+    .frame_queue_backend = FRAME_QUEUE_BACKEND_RING_BUFFER,
+    .use_huge_pages = TRUE,
+    .capture_backend = CAPTURE_BACKEND_OPENCV,
+    .frame_pacing = FRAME_PACING_SEQUENCER,
+    .difference_worker_count = 1,
+    .difference_worker_cpus = {3},
+    .tick_frequency = CLOCK_TICK_FREQUENCY,
+    .write_completion_cpu = 0,
+    .region_detection_cpu = 0,
     .message_queue_attributes = {
         .mq_maxmsg = NUMBER_OF_FRAMES,
         .mq_msgsize = sizeof(Frame *),
@@ -33,15 +76,21 @@ FramePipeline frame_pipeline = {
  * @brief The service schedule.
  */
 Schedule schedule = {
-    .frequency = 3,
+    .frequency = CLOCK_TICK_FREQUENCY * FRAMES_PER_TICK,
     .maximum_iterations = 5600,
     .iteration_counter = 0,
+    .minor_frame = 0,
     .sequencer_cpu = 0,
+    .sequencer_mode = SEQUENCER_MODE_THREAD,
+    .catch_up_policy = CATCH_UP_POLICY_SKIP,
+    .schedulability_policy = SCHEDULABILITY_POLICY_WARN,
+    .execution_mode = EXECUTION_MODE_FIFO,
     .services = {
         {
             .id = 1,
             .name = "Capture Frame",
             .period = 1,
+            .phase = 0,
             .cpu = 1,
             .exit_flag = FALSE,
             .frame_pipeline = &frame_pipeline,
@@ -53,6 +102,7 @@ Schedule schedule = {
             .id = 2,
             .name = "Difference Frame",
             .period = 1,
+            .phase = 0,
             .cpu = 2,
             .exit_flag = FALSE,
             .frame_pipeline = &frame_pipeline,
@@ -64,6 +114,7 @@ Schedule schedule = {
             .id = 3,
             .name = "Select Frame",
             .period = 1,
+            .phase = 0,
             .cpu = 2,
             .exit_flag = FALSE,
             .frame_pipeline = &frame_pipeline,
@@ -74,7 +125,8 @@ Schedule schedule = {
         {
             .id = 4,
             .name = "Write Frame",
-            .period = 3,
+            .period = FRAMES_PER_TICK,
+            .phase = 0,
             .cpu = 2,
             .exit_flag = FALSE,
             .frame_pipeline = &frame_pipeline,
@@ -85,13 +137,16 @@ Schedule schedule = {
     }};
 
 /**
- * @brief Compare two services' periods for sorting priority.
+ * @brief Compare two services' periods for sorting priority. Services with
+ * the same period keep their order by id, since `qsort()` is not stable.
  */
 int compare_service_periods(const void *a, const void *b)
 {
   const Service *service_a = (Service *)a;
   const Service *service_b = (Service *)b;
-  return service_a->period - service_b->period;
+  if (service_a->period != service_b->period)
+    return service_a->period - service_b->period;
+  return service_a->id - service_b->id;
 }
 
 /**
@@ -105,6 +160,181 @@ void assign_service_priorities(Schedule *schedule)
     schedule->services[index].priority_descending = index + 1;
 }
 
+/**
+ * @brief Calculate the greatest common divisor of two positive integers.
+ */
+unsigned int get_greatest_common_divisor(unsigned int a, unsigned int b)
+{
+  while (b != 0)
+  {
+    unsigned int modulus = a % b;
+    a = b;
+    b = modulus;
+  }
+  return a;
+}
+
+/**
+ * @brief Compute the hyperperiod of the schedule, the least common multiple of
+ * all service periods, and build a table holding a bitmask of the services to
+ * release in each minor frame of the hyperperiod. Bit `n` of each entry
+ * corresponds to `services[n]`, so the services must already be sorted.
+ */
+void initialize_release_table(Schedule *schedule)
+{
+  // Compute the hyperperiod.
+  unsigned int hyperperiod = 1;
+  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+  {
+    Service *service = &schedule->services[index];
+    if (service->period < 1)
+      print_error_and_exit("Service: %i (%s) period must be positive\n", service->id, service->name);
+    if (service->phase < 0 || service->phase >= service->period)
+      print_error_and_exit("Service: %i (%s) phase must be within its period\n", service->id, service->name);
+
+    hyperperiod = hyperperiod / get_greatest_common_divisor(hyperperiod, service->period) * service->period;
+    if (hyperperiod > MAXIMUM_HYPERPERIOD)
+      print_error_and_exit("Schedule hyperperiod exceeds %i\n", MAXIMUM_HYPERPERIOD);
+  }
+  schedule->hyperperiod = hyperperiod;
+
+  // Mark each service's releases within the hyperperiod. Under
+  // `SCHED_DEADLINE` the kernel releases the services instead.
+  for (unsigned int minor_frame = 0; minor_frame < hyperperiod; ++minor_frame)
+  {
+    schedule->release_table[minor_frame] = 0;
+    if (schedule->execution_mode == EXECUTION_MODE_DEADLINE)
+      continue;
+    for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+    {
+      Service *service = &schedule->services[index];
+      if ((minor_frame % service->period) == (unsigned int)service->phase)
+        schedule->release_table[minor_frame] |= 1U << index;
+    }
+  }
+  schedule->minor_frame = schedule->iteration_counter % hyperperiod;
+
+  write_log("Sequencer: Hyperperiod: %u", schedule->hyperperiod);
+}
+
+/**
+ * @brief Record the current time as the release time of a service's next
+ * request. Only the sequencer may call this.
+ */
+void record_release_time(Service *service)
+{
+  unsigned long long release_count = service->release_count;
+  // Order the previous release's count ahead of overwriting its oldest slot,
+  // so that a service copying that slot sees the count move past it.
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  get_current_monotonic_time(&service->release_times[release_count % RELEASE_TIME_QUEUE_LENGTH]);
+  __atomic_store_n(&service->release_count, release_count + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Record the timing of a completed service request, and detect whether
+ * it missed its deadline by completing after the service's next release.
+ *
+ * A service that falls `RELEASE_TIME_QUEUE_LENGTH` or more releases behind
+ * finds its request's release time overwritten, or being overwritten, by a
+ * newer one. Such a request has certainly missed its deadline, but its
+ * response time is unknown, so it is counted as an overrun rather than
+ * recorded. The release count is re-read after copying the release time, so
+ * that a copy torn by a concurrent release is also caught.
+ */
+void record_request_timing(
+    Service *service,
+    unsigned int request_counter,
+    struct timespec *start_time,
+    struct timespec *complete_time)
+{
+  record_histogram_value(
+      &service->execution_time_histogram,
+      get_elapsed_time_in_nanoseconds(start_time, complete_time));
+
+  // Ensure the sequencer's release time for this request is visible, and has
+  // not since been overwritten.
+  unsigned long long release_count = __atomic_load_n(&service->release_count, __ATOMIC_ACQUIRE);
+  if (request_counter >= release_count)
+    print_error_and_exit("Service: %i (%s) request %u has no release\n", service->id, service->name, request_counter);
+
+  struct timespec release_time;
+  if (release_count < request_counter + RELEASE_TIME_QUEUE_LENGTH)
+  {
+    release_time = service->release_times[request_counter % RELEASE_TIME_QUEUE_LENGTH];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    release_count = __atomic_load_n(&service->release_count, __ATOMIC_RELAXED);
+  }
+
+  if (release_count >= request_counter + RELEASE_TIME_QUEUE_LENGTH)
+  {
+    ++service->release_overrun_count;
+    __atomic_fetch_add(&service->deadline_miss_count, 1, __ATOMIC_RELAXED);
+  }
+  else
+  {
+    long long response_time = get_elapsed_time_in_nanoseconds(&release_time, complete_time);
+    record_histogram_value(&service->response_time_histogram, response_time);
+
+    if (response_time > service->deadline_nanoseconds)
+      __atomic_fetch_add(&service->deadline_miss_count, 1, __ATOMIC_RELAXED);
+  }
+
+  // Record the time the service spent working, excluding time blocked on its
+  // queues, if it stamped its work timer during this request.
+  if (service->work_complete_time.tv_sec != 0 || service->work_complete_time.tv_nsec != 0)
+    record_histogram_value(
+        &service->work_time_histogram,
+        get_elapsed_time_in_nanoseconds(&service->work_start_time, &service->work_complete_time));
+}
+
+/**
+ * @brief Initialize the timing measurements of the sequencer and every
+ * service. A service request's deadline is the service's next release.
+ */
+void initialize_service_timing(Schedule *schedule)
+{
+  initialize_histogram(&schedule->sequencer_histogram);
+  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+  {
+    Service *service = &schedule->services[index];
+    service->deadline_nanoseconds = llround(service->period * NANOSECONDS_PER_SECOND / schedule->frequency);
+    initialize_histogram(&service->execution_time_histogram);
+    initialize_histogram(&service->response_time_histogram);
+    initialize_histogram(&service->work_time_histogram);
+  }
+}
+
+/**
+ * @brief Switch the calling thread to `SCHED_DEADLINE`, with a period and
+ * deadline of the service's period, and the service's runtime budget.
+ */
+void set_current_thread_to_deadline(Service *service)
+{
+  SchedulingAttributes attributes = {};
+  attributes.size = sizeof(SchedulingAttributes);
+  attributes.sched_policy = SCHED_DEADLINE;
+  attributes.sched_runtime = service->runtime_nanoseconds;
+  attributes.sched_deadline = service->deadline_nanoseconds;
+  attributes.sched_period = service->deadline_nanoseconds;
+  attempt(
+      syscall(SYS_sched_setattr, 0, &attributes, 0),
+      "sched_setattr() %s",
+      service->name);
+}
+
+/**
+ * @brief Record the release time of a `SCHED_DEADLINE` service's request,
+ * which the kernel releases one period after the previous one.
+ */
+void record_deadline_release_time(Service *service, unsigned int request_counter, struct timespec *first_release_time)
+{
+  struct timespec *release_time = &service->release_times[request_counter % RELEASE_TIME_QUEUE_LENGTH];
+  *release_time = *first_release_time;
+  add_nanoseconds_to_timespec(release_time, request_counter * service->deadline_nanoseconds);
+  __atomic_store_n(&service->release_count, request_counter + 1, __ATOMIC_RELEASE);
+}
+
 /**
  * @brief A real-time service thread entry point, for use with
  * `pthread_create()`. Provides initialization of service thread resources. The
@@ -121,16 +351,33 @@ void *ServiceThread(void *thread_parameters)
     (service->setup_function)(service->frame_pipeline);
   write_log("Service: %i (%s) SETUP COMPLETE", service->id, service->name);
 
+  // Hand releases over to the kernel, if indicated.
+  if (service->execution_mode == EXECUTION_MODE_DEADLINE)
+    set_current_thread_to_deadline(service);
+
   // Allow sequencer to proceed.
   attempt(
       sem_post(&service->setup_semaphore),
       "sem_post()");
 
   unsigned int request_counter = 0;
+  struct timespec start_time, complete_time, first_release_time;
   while (TRUE)
   {
-    // Block until requested.
-    attempt(sem_wait(&service->semaphore), "sem_wait()");
+    // Block until requested. Under `SCHED_DEADLINE`, the sequencer starts the
+    // first request, and yielding waits for the kernel to release the next.
+    if (service->execution_mode == EXECUTION_MODE_FIFO || request_counter == 0)
+      attempt(sem_wait(&service->semaphore), "sem_wait()");
+    else
+      attempt(sched_yield(), "sched_yield()");
+    get_current_monotonic_time(&start_time);
+
+    if (service->execution_mode == EXECUTION_MODE_DEADLINE)
+    {
+      if (request_counter == 0)
+        first_release_time = start_time;
+      record_deadline_release_time(service, request_counter, &first_release_time);
+    }
 
     // Exit the thread if indicated.
     if (service->exit_flag)
@@ -146,7 +393,11 @@ void *ServiceThread(void *thread_parameters)
     }
 
     // Perform the work.
+    service->work_start_time = {};
+    service->work_complete_time = {};
     (service->service_function)(service->frame_pipeline, service, request_counter);
+    get_current_monotonic_time(&complete_time);
+    record_request_timing(service, request_counter, &start_time, &complete_time);
 
     // Begin new service request by incrementing the counter.
     ++request_counter;
@@ -161,14 +412,17 @@ void terminate_all_service_threads(Schedule *schedule)
   Service *services = schedule->services;
 
   // Disable the interval timer.
-  get_timespec_from_seconds(0, &schedule->timer_interval.it_value);
-  get_timespec_from_seconds(0, &schedule->timer_interval.it_interval);
-  attempt(timer_settime(
-              schedule->timer,
-              0,
-              &schedule->timer_interval,
-              NULL),
-          "timer_settime()");
+  if (schedule->sequencer_mode == SEQUENCER_MODE_SIGNAL)
+  {
+    get_timespec_from_seconds(0, &schedule->timer_interval.it_value);
+    get_timespec_from_seconds(0, &schedule->timer_interval.it_interval);
+    attempt(timer_settime(
+                schedule->timer,
+                0,
+                &schedule->timer_interval,
+                NULL),
+            "timer_settime()");
+  }
 
   // Set all services to terminate.
   for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
@@ -180,6 +434,102 @@ void terminate_all_service_threads(Schedule *schedule)
   }
 }
 
+/**
+ * @brief Advance the iteration counter. Terminates all services once the
+ * maximum number of iterations is reached.
+ */
+void advance_iteration_counter(Schedule *schedule)
+{
+  // Increment the sequence counter.
+  ++schedule->iteration_counter;
+  if (++schedule->minor_frame == schedule->hyperperiod)
+    schedule->minor_frame = 0;
+
+  if (schedule->iteration_counter >= schedule->maximum_iterations)
+    terminate_all_service_threads(schedule);
+}
+
+/**
+ * @brief Release all the services that are scheduled for the current
+ * iteration, then advance the iteration counter.
+ *
+ * Does no logging, so it is safe to call from the release path of any
+ * sequencer.
+ */
+void release_scheduled_services(Schedule *schedule)
+{
+  struct timespec start_time, complete_time;
+  get_current_monotonic_time(&start_time);
+
+  // Release all the services that are scheduled for this minor frame.
+  for (unsigned int releases = schedule->release_table[schedule->minor_frame];
+       releases != 0;
+       releases &= releases - 1)
+  {
+    Service *service = &schedule->services[__builtin_ctz(releases)];
+    record_release_time(service);
+    attempt(sem_post(&service->semaphore), "sem_post()");
+  }
+
+  get_current_monotonic_time(&complete_time);
+  record_histogram_value(
+      &schedule->sequencer_histogram,
+      get_elapsed_time_in_nanoseconds(&start_time, &complete_time));
+
+  advance_iteration_counter(schedule);
+}
+
+/**
+ * @brief Count a missed release against every service that is scheduled for
+ * the current iteration, without releasing them.
+ */
+void count_missed_releases(Schedule *schedule)
+{
+  for (unsigned int releases = schedule->release_table[schedule->minor_frame];
+       releases != 0;
+       releases &= releases - 1)
+    ++schedule->services[__builtin_ctz(releases)].missed_release_count;
+}
+
+/**
+ * @brief Handle a timer wakeup that reports the given number of expirations,
+ * applying the schedule's catch-up policy to any ticks that were missed.
+ *
+ * Does no logging, so it is safe to call from the release path of any
+ * sequencer.
+ */
+void handle_timer_expirations(Schedule *schedule, unsigned long long expirations)
+{
+  unsigned long long missed_ticks = expirations - 1;
+  schedule->missed_tick_count += missed_ticks;
+
+  for (unsigned long long tick = 0;
+       tick < missed_ticks && schedule->iteration_counter < schedule->maximum_iterations;
+       ++tick)
+  {
+    switch (schedule->catch_up_policy)
+    {
+    case CATCH_UP_POLICY_SKIP:
+      // Drop the missed releases.
+      count_missed_releases(schedule);
+      advance_iteration_counter(schedule);
+      break;
+    case CATCH_UP_POLICY_BURST:
+      // Issue the missed releases late.
+      count_missed_releases(schedule);
+      release_scheduled_services(schedule);
+      break;
+    case CATCH_UP_POLICY_SHIFT_PHASE:
+      // Leave the iteration counter behind the timer.
+      break;
+    }
+  }
+
+  // Issue the release for this tick.
+  if (schedule->iteration_counter < schedule->maximum_iterations)
+    release_scheduled_services(schedule);
+}
+
 /**
  * @brief A sequencer function. Generates requests for services according to
  * the defined schedule.
@@ -187,20 +537,142 @@ void terminate_all_service_threads(Schedule *schedule)
 void Sequencer(int signal_number)
 {
   write_log_with_timer("Sequencer: %llu", schedule.iteration_counter);
+  release_scheduled_services(&schedule);
+}
+
+/**
+ * @brief A sequencer thread entry point, for use with `pthread_create()`.
+ * Generates requests for services according to the schedule provided in the
+ * thread arguments.
+ *
+ * Each release time is computed from the sequencer start time and the
+ * iteration counter, and the thread sleeps until that absolute time on
+ * `CLOCK_MONOTONIC`, so releases never accumulate drift and are unaffected by
+ * adjustments to the system clock.
+ */
+void *SequencerThread(void *thread_parameters)
+{
+  // Unpack the thread parameters.
+  Schedule *schedule = (Schedule *)thread_parameters;
+
+  write_log("Sequencer: THREAD STARTED, Frequency: %f", schedule->frequency);
 
-  // Release all the services that are scheduled for this time unit.
+  struct timespec release_time;
+  while (schedule->iteration_counter < schedule->maximum_iterations)
+  {
+    // Compute the absolute time of the next release. The first release
+    // happens one period after the start time, as with the interval timer.
+    release_time = schedule->sequencer_start_time;
+    add_nanoseconds_to_timespec(
+        &release_time,
+        llround((schedule->iteration_counter + 1) * NANOSECONDS_PER_SECOND / schedule->frequency));
+
+    // Sleep until the release time, resuming if interrupted.
+    while ((errno = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &release_time, NULL)) == EINTR)
+      ;
+    if (errno)
+      print_with_errno_and_exit("clock_nanosleep()");
+
+    release_scheduled_services(schedule);
+  }
+
+  write_log_with_timer("Sequencer: THREAD COMPLETE, Iterations: %llu", schedule->iteration_counter);
+  return (void *)0;
+}
+
+/**
+ * @brief Log the number of ticks the sequencer missed, and the number of
+ * releases each service missed as a result.
+ */
+void log_missed_releases(Schedule *schedule)
+{
+  write_log("Sequencer: Missed Ticks: %llu", schedule->missed_tick_count);
   for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
   {
-    Service *service = &schedule.services[index];
-    if ((schedule.iteration_counter % service->period) == 0)
-      attempt(sem_post(&service->semaphore), "sem_post()");
+    Service *service = &schedule->services[index];
+    write_log(
+        "Service: %i (%s) Missed Releases: %llu",
+        service->id,
+        service->name,
+        service->missed_release_count);
   }
+}
 
-  // Increment the sequence counter.
-  ++schedule.iteration_counter;
+/**
+ * @brief A sequencer thread entry point, for use with `pthread_create()`.
+ * Generates requests for services according to the schedule provided in the
+ * thread arguments.
+ *
+ * Waits on a `CLOCK_MONOTONIC` `timerfd` in an epoll loop. Every wakeup reads
+ * the timer's expiration count, so ticks that were missed while the sequencer
+ * could not run are detected and handled by the schedule's catch-up policy.
+ */
+void *TimerSequencerThread(void *thread_parameters)
+{
+  // Unpack the thread parameters.
+  Schedule *schedule = (Schedule *)thread_parameters;
 
-  if (schedule.iteration_counter >= schedule.maximum_iterations)
-    terminate_all_service_threads(&schedule);
+  // Initialize the timer.
+  schedule->timer_file_descriptor = attempt(
+      timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC),
+      "timerfd_create()");
+  get_timespec_from_seconds(
+      1 / schedule->frequency,
+      &schedule->timer_interval.it_value);
+  get_timespec_from_seconds(
+      1 / schedule->frequency,
+      &schedule->timer_interval.it_interval);
+
+  // Initialize the event loop.
+  schedule->epoll_file_descriptor = attempt(
+      epoll_create1(EPOLL_CLOEXEC),
+      "epoll_create1()");
+  struct epoll_event timer_event = {.events = EPOLLIN};
+  timer_event.data.fd = schedule->timer_file_descriptor;
+  attempt(
+      epoll_ctl(
+          schedule->epoll_file_descriptor,
+          EPOLL_CTL_ADD,
+          schedule->timer_file_descriptor,
+          &timer_event),
+      "epoll_ctl()");
+
+  write_log("Sequencer: TIMERFD THREAD STARTED, Frequency: %f", schedule->frequency);
+
+  // Start the timer.
+  attempt(
+      timerfd_settime(
+          schedule->timer_file_descriptor,
+          0,
+          &schedule->timer_interval,
+          NULL),
+      "timerfd_settime()");
+
+  struct epoll_event event;
+  unsigned long long expirations;
+  while (schedule->iteration_counter < schedule->maximum_iterations)
+  {
+    // Wait for the timer, resuming if interrupted.
+    int event_count = epoll_wait(schedule->epoll_file_descriptor, &event, 1, -1);
+    if (event_count == -1 && errno == EINTR)
+      continue;
+    attempt(event_count, "epoll_wait()");
+
+    // Read the number of expirations since the previous wakeup.
+    attempt(
+        read(schedule->timer_file_descriptor, &expirations, sizeof(expirations)),
+        "read() timer_file_descriptor");
+
+    handle_timer_expirations(schedule, expirations);
+  }
+
+  // Release the timer and event loop.
+  attempt(close(schedule->epoll_file_descriptor), "close() epoll_file_descriptor");
+  attempt(close(schedule->timer_file_descriptor), "close() timer_file_descriptor");
+
+  write_log_with_timer("Sequencer: TIMERFD THREAD COMPLETE, Iterations: %llu", schedule->iteration_counter);
+  log_missed_releases(schedule);
+  return (void *)0;
 }
 
 /**
@@ -243,46 +715,87 @@ void initialize_real_time_thread_attributes(
     print_with_errno_and_exit("pthread_attr_setschedparam()");
 }
 
+/**
+ * @brief Initialize `SCHED_DEADLINE` thread attributes. The thread starts
+ * under `SCHED_OTHER` and switches itself to `SCHED_DEADLINE` once set up.
+ *
+ * The kernel only admits `SCHED_DEADLINE` threads whose affinity spans their
+ * whole root domain, so the thread may run on any CPU. Confining deadline
+ * services to particular CPUs requires an exclusive cpuset, configured
+ * outside this program.
+ */
+void initialize_deadline_thread_attributes(pthread_attr_t *thread_attributes)
+{
+  // Initialize default attributes
+  errno = pthread_attr_init(thread_attributes);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_init()");
+
+  // Disable thread schedule inheritence
+  errno = pthread_attr_setinheritsched(thread_attributes, PTHREAD_EXPLICIT_SCHED);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setinheritsched()");
+
+  // Start with normal scheduling
+  errno = pthread_attr_setschedpolicy(thread_attributes, SCHED_OTHER);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setschedpolicy()");
+
+  struct sched_param schedule_parameters = {.sched_priority = 0};
+  errno = pthread_attr_setschedparam(thread_attributes, &schedule_parameters);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setschedparam()");
+
+  // Allow every CPU.
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; ++cpu)
+    CPU_SET(cpu, &cpu_set);
+  errno = pthread_attr_setaffinity_np(thread_attributes, sizeof(cpu_set_t), &cpu_set);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setaffinity_np()");
+}
+
 /**
  * @brief Initialize the resources used by the frame pipeline.
  */
 void initialize_frame_pipeline(FramePipeline *frame_pipeline)
 {
-  // Initialize the available frame queue
-  mq_unlink(AVAILABLE_FRAME_QUEUE_NAME);
-  frame_pipeline->available_frame_queue = mq_open(AVAILABLE_FRAME_QUEUE_NAME,
-                                                  O_CREAT | O_RDWR,
-                                                  S_IRWXU,
-                                                  &frame_pipeline->message_queue_attributes);
-  if (frame_pipeline->available_frame_queue == -1)
-    print_with_errno_and_exit("mq_open() failed opening available_frame_queue");
-
-  // Initialize the captured frame queue
-  mq_unlink(CAPTURED_FRAME_QUEUE_NAME);
-  frame_pipeline->captured_frame_queue = mq_open(CAPTURED_FRAME_QUEUE_NAME,
-                                                 O_CREAT | O_RDWR,
-                                                 S_IRWXU,
-                                                 &frame_pipeline->message_queue_attributes);
-  if (frame_pipeline->captured_frame_queue == -1)
-    print_with_errno_and_exit("mq_open() failed opening captured_frame_queue");
-
-  // Initialize the difference frame queue
-  mq_unlink(DIFFERENCE_FRAME_QUEUE_NAME);
-  frame_pipeline->difference_frame_queue = mq_open(DIFFERENCE_FRAME_QUEUE_NAME,
-                                                   O_CREAT | O_RDWR,
-                                                   S_IRWXU,
-                                                   &frame_pipeline->message_queue_attributes);
-  if (frame_pipeline->difference_frame_queue == -1)
-    print_with_errno_and_exit("mq_open() failed opening difference_frame_queue");
-
-  // Initialize the selected frame queue
-  mq_unlink(SELECTED_FRAME_QUEUE_NAME);
-  frame_pipeline->selected_frame_queue = mq_open(SELECTED_FRAME_QUEUE_NAME,
-                                                 O_CREAT | O_RDWR,
-                                                 S_IRWXU,
-                                                 &frame_pipeline->message_queue_attributes);
-  if (frame_pipeline->selected_frame_queue == -1)
-    print_with_errno_and_exit("mq_open() failed opening selected_frame_queue");
+  // Any stage may release the last reference to a frame, so every stage may
+  // produce available frames.
+  initialize_frame_queue(
+      &frame_pipeline->available_frame_queue,
+      AVAILABLE_FRAME_QUEUE_NAME,
+      frame_pipeline->frame_queue_backend,
+      &frame_pipeline->message_queue_attributes,
+      TRUE);
+  initialize_frame_queue(
+      &frame_pipeline->captured_frame_queue,
+      CAPTURED_FRAME_QUEUE_NAME,
+      frame_pipeline->frame_queue_backend,
+      &frame_pipeline->message_queue_attributes,
+      FALSE);
+  initialize_frame_queue(
+      &frame_pipeline->difference_frame_queue,
+      DIFFERENCE_FRAME_QUEUE_NAME,
+      frame_pipeline->frame_queue_backend,
+      &frame_pipeline->message_queue_attributes,
+      FALSE);
+  initialize_frame_queue(
+      &frame_pipeline->selected_frame_queue,
+      SELECTED_FRAME_QUEUE_NAME,
+      frame_pipeline->frame_queue_backend,
+      &frame_pipeline->message_queue_attributes,
+      FALSE);
+
+  // The tracker searches for the clock's ticks from the first frame, using the
+  // fixed threshold until Select Frame has calibrated its own.
+  initialize_tick_tracker(&frame_pipeline->tick_tracker, 1.0 / frame_pipeline->tick_frequency);
+  frame_pipeline->tick_threshold.rising_percentage.store(TICK_DETECTION_THRESHOLD_PERCENTAGE);
+  frame_pipeline->tick_threshold.falling_percentage.store(TICK_DETECTION_THRESHOLD_PERCENTAGE);
+
+  // Write Frame reports when it has no room for more writes.
+  frame_pipeline->is_write_backpressured.store(FALSE);
 }
 
 /**
@@ -290,21 +803,12 @@ void initialize_frame_pipeline(FramePipeline *frame_pipeline)
  */
 void uninitialize_frame_pipeline(FramePipeline *frame_pipeline)
 {
-  // Close the available message queue.
-  attempt(mq_close(frame_pipeline->available_frame_queue), "mq_close() available_frame_queue");
-  mq_unlink(AVAILABLE_FRAME_QUEUE_NAME);
-
-  // Close the captured message queue.
-  attempt(mq_close(frame_pipeline->captured_frame_queue), "mq_close() captured_frame_queue");
-  mq_unlink(CAPTURED_FRAME_QUEUE_NAME);
-
-  // Close the difference message queue.
-  attempt(mq_close(frame_pipeline->difference_frame_queue), "mq_close() difference_frame_queue");
-  mq_unlink(DIFFERENCE_FRAME_QUEUE_NAME);
-
-  // Close the selected message queue.
-  attempt(mq_close(frame_pipeline->selected_frame_queue), "mq_close() selected_frame_queue");
-  mq_unlink(SELECTED_FRAME_QUEUE_NAME);
+  uninitialize_frame_queue(&frame_pipeline->available_frame_queue);
+  uninitialize_frame_queue(&frame_pipeline->captured_frame_queue);
+  uninitialize_frame_queue(&frame_pipeline->difference_frame_queue);
+  uninitialize_frame_queue(&frame_pipeline->selected_frame_queue);
+  uninitialize_tick_tracker(&frame_pipeline->tick_tracker);
+  uninitialize_frame_arena(frame_pipeline);
 }
 
 /**
@@ -313,6 +817,10 @@ void uninitialize_frame_pipeline(FramePipeline *frame_pipeline)
  */
 void start_all_service_threads(Schedule *schedule, FramePipeline *frame_pipeline)
 {
+  // Capture Frame lays out the frame arena, so it must be set up first.
+  if (schedule->services[0].setup_function != capture_frame_setup)
+    print_error_and_exit("Capture Frame must have the shortest period and lowest id\n");
+
   // Start each service thread.
   for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
   {
@@ -329,11 +837,27 @@ void start_all_service_threads(Schedule *schedule, FramePipeline *frame_pipeline
         "sem_init()");
 
     // Initialize the thread attributes for real-time.
-    initialize_real_time_thread_attributes(
-        &service->thread_attributes,
-        &service->schedule_parameters,
-        service->cpu,
-        service->priority_descending);
+    service->execution_mode = schedule->execution_mode;
+    if (service->execution_mode == EXECUTION_MODE_DEADLINE)
+    {
+      // Budget the measured WCET with a margin, if there is one.
+      if (service->wcet_nanoseconds > 0)
+        service->runtime_nanoseconds = llround(service->wcet_nanoseconds * DEADLINE_RUNTIME_MARGIN);
+      else
+        service->runtime_nanoseconds = llround(service->deadline_nanoseconds * DEADLINE_DEFAULT_RUNTIME_FRACTION);
+      if (service->runtime_nanoseconds < DEADLINE_MINIMUM_RUNTIME_NANOSECONDS)
+        service->runtime_nanoseconds = DEADLINE_MINIMUM_RUNTIME_NANOSECONDS;
+      if (service->runtime_nanoseconds > service->deadline_nanoseconds)
+        service->runtime_nanoseconds = service->deadline_nanoseconds;
+
+      initialize_deadline_thread_attributes(&service->thread_attributes);
+    }
+    else
+      initialize_real_time_thread_attributes(
+          &service->thread_attributes,
+          &service->schedule_parameters,
+          service->cpu,
+          service->priority_descending);
 
     // Start the service's thread.
     write_log("Service: %i (%s) THREAD CREATE STARTED...\n", service->id, service->name);
@@ -345,12 +869,10 @@ void start_all_service_threads(Schedule *schedule, FramePipeline *frame_pipeline
     if (errno)
       print_with_errno_and_exit("pthread_create()");
     write_log("Service: %i (%s) THREAD CREATE COMPLETE", service->id, service->name);
-  }
 
-  // Wait for each service thread to finish setup.
-  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
-  {
-    Service *service = &schedule->services[index];
+    // Wait for the service thread to finish setup before starting the next,
+    // so that each service's setup follows Capture Frame's layout of the
+    // frame arena.
     attempt(sem_wait(&service->setup_semaphore), "sem_wait()");
     write_log("Service: %i (%s) READY", service->id, service->name);
   }
@@ -372,9 +894,10 @@ void join_all_service_threads(Schedule *schedule)
 }
 
 /**
- * @brief Start sequencing service requests according to the provided schedule.
+ * @brief Start sequencing service requests according to the provided schedule,
+ * using a `SIGALRM` handler driven by a POSIX interval timer.
  */
-void begin_sequencing(Schedule *schedule)
+void begin_signal_sequencing(Schedule *schedule)
 {
   // Configure the interval handler.
   struct sigaction alarm_action = {.sa_handler = (void (*)(int))Sequencer};
@@ -404,6 +927,119 @@ void begin_sequencing(Schedule *schedule)
       "timer_settime()");
 }
 
+/**
+ * @brief Start sequencing service requests according to the provided schedule,
+ * using a dedicated real-time sequencer thread running the given entry point.
+ */
+void begin_thread_sequencing(Schedule *schedule, void *(*sequencer_thread)(void *))
+{
+  // Run the sequencer above every service, on the sequencer CPU.
+  initialize_real_time_thread_attributes(
+      &schedule->sequencer_thread_attributes,
+      &schedule->sequencer_schedule_parameters,
+      schedule->sequencer_cpu,
+      0);
+
+  // Start the sequencer thread.
+  start_log_timer();
+  get_current_monotonic_time(&schedule->sequencer_start_time);
+  errno = pthread_create(
+      &schedule->sequencer_thread_descriptor,
+      &schedule->sequencer_thread_attributes,
+      sequencer_thread,
+      schedule);
+  if (errno)
+    print_with_errno_and_exit("pthread_create()");
+}
+
+/**
+ * @brief Start sequencing service requests according to the provided schedule.
+ */
+void begin_sequencing(Schedule *schedule)
+{
+  // Start the first request of each `SCHED_DEADLINE` service. The kernel
+  // releases the rest.
+  if (schedule->execution_mode == EXECUTION_MODE_DEADLINE)
+    for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+      attempt(sem_post(&schedule->services[index].semaphore), "sem_post()");
+
+  switch (schedule->sequencer_mode)
+  {
+  case SEQUENCER_MODE_SIGNAL:
+    begin_signal_sequencing(schedule);
+    break;
+  case SEQUENCER_MODE_THREAD:
+    begin_thread_sequencing(schedule, SequencerThread);
+    break;
+  case SEQUENCER_MODE_TIMERFD:
+    begin_thread_sequencing(schedule, TimerSequencerThread);
+    break;
+  }
+}
+
+/**
+ * @brief Join the calling thread to the sequencer thread, if the schedule uses
+ * one.
+ */
+void join_sequencer_thread(Schedule *schedule)
+{
+  if (schedule->sequencer_mode == SEQUENCER_MODE_SIGNAL)
+    return;
+
+  errno = pthread_join(schedule->sequencer_thread_descriptor, NULL);
+  if (errno)
+    print_with_errno_and_exit("pthread_join()");
+}
+
+/**
+ * @brief Print a line of statistics, in milliseconds, for a timing histogram.
+ */
+void print_histogram_statistics(const char *label, Histogram *histogram)
+{
+  printf(
+      "  %-16s Min: %10.3f ms, Mean: %10.3f ms, P99: %10.3f ms, Max: %10.3f ms\n",
+      label,
+      (double)get_histogram_minimum(histogram) / NANOSECONDS_PER_MILLSECOND,
+      get_histogram_mean(histogram) / NANOSECONDS_PER_MILLSECOND,
+      (double)get_histogram_percentile(histogram, 99) / NANOSECONDS_PER_MILLSECOND,
+      (double)get_histogram_maximum(histogram) / NANOSECONDS_PER_MILLSECOND);
+}
+
+/**
+ * @brief Print and log the execution time, response time, and deadline misses
+ * of every service in the schedule.
+ */
+void report_service_timing(Schedule *schedule)
+{
+  for (int index = 0; index < NUMBER_OF_SERVICES; ++index)
+  {
+    Service *service = &schedule->services[index];
+    printf(
+        "Service: %i (%s), Requests: %llu, Deadline: %.3f ms, Deadline Misses: %llu, Release Overruns: %llu\n",
+        service->id,
+        service->name,
+        get_histogram_count(&service->execution_time_histogram),
+        (double)service->deadline_nanoseconds / NANOSECONDS_PER_MILLSECOND,
+        service->deadline_miss_count,
+        service->release_overrun_count);
+    print_histogram_statistics("Execution Time:", &service->execution_time_histogram);
+    print_histogram_statistics("Response Time:", &service->response_time_histogram);
+
+    write_log(
+        "Service: %i (%s) TIMING, Requests: %llu, Deadline Misses: %llu, Release Overruns: %llu, "
+        "Execution Max: %llu ns, Execution P99: %llu ns, Response Max: %llu ns, Response P99: %llu ns",
+        service->id,
+        service->name,
+        get_histogram_count(&service->execution_time_histogram),
+        service->deadline_miss_count,
+        service->release_overrun_count,
+        get_histogram_maximum(&service->execution_time_histogram),
+        get_histogram_percentile(&service->execution_time_histogram, 99),
+        get_histogram_maximum(&service->response_time_histogram),
+        get_histogram_percentile(&service->response_time_histogram, 99));
+  }
+}
+
 /**
  * @brief Set the calling thread to the highest-priority real-time schedule.
  */
@@ -457,9 +1093,26 @@ int main()
   initialize_frame_pipeline(&frame_pipeline);
 
   assign_service_priorities(&schedule);
+  initialize_release_table(&schedule);
+  initialize_service_timing(&schedule);
+
+  // Check the schedule against the previous run's measurements, or calibrate.
+  if (load_measured_wcets(&schedule, WCET_FILENAME))
+  {
+    if (!analyze_schedulability(&schedule) && schedule.schedulability_policy == SCHEDULABILITY_POLICY_ENFORCE)
+      print_error_and_exit("FATAL: Schedule is not guaranteed to meet its deadlines.\n");
+  }
+  else
+    printf("No measured WCETs in %s, performing a calibration run.\n", WCET_FILENAME);
+
   start_all_service_threads(&schedule, &frame_pipeline);
   begin_sequencing(&schedule);
 
+  join_sequencer_thread(&schedule);
   join_all_service_threads(&schedule);
+  schedule.critical_section_nanoseconds = get_longest_critical_section(&frame_pipeline);
   uninitialize_frame_pipeline(&frame_pipeline);
+
+  report_service_timing(&schedule);
+  save_measured_wcets(&schedule, WCET_FILENAME);
 }
@@ -1,47 +1,269 @@
 #ifndef SEQUENCER_H
 #define SEQUENCER_H
 
+#include <atomic>
 #include <mqueue.h>
 #include <opencv2/videoio.hpp>
 #include <pthread.h>
 #include <semaphore.h>
 #include <time.h>
+#include "utils/histogram.h"
+#include "utils/ring_buffer.hpp"
 
 #define TRUE (1)
 #define FALSE (0)
 
 #define NUMBER_OF_SERVICES (4)
 #define NUMBER_OF_FRAMES (100)
+#define MAXIMUM_HYPERPERIOD (360)
+#define RELEASE_TIME_QUEUE_LENGTH (64)
+#define FRAME_TILE_SIZE (64)
+#define MAXIMUM_DIFFERENCE_WORKERS (4)
 
 #define AVAILABLE_FRAME_QUEUE_NAME "/available_frame_queue"
 #define CAPTURED_FRAME_QUEUE_NAME "/captured_frame_queue"
 #define DIFFERENCE_FRAME_QUEUE_NAME "/difference_frame_queue"
 #define SELECTED_FRAME_QUEUE_NAME "/selected_frame_queue"
 
+/**
+ * @brief The pixel format of a frame buffer.
+ */
+typedef enum FrameFormat
+{
+  FRAME_FORMAT_BGR,
+  FRAME_FORMAT_YUYV,
+  FRAME_FORMAT_GREY,
+} FrameFormat;
+
+/**
+ * @brief Where a frame falls relative to the clock's predicted ticks.
+ *
+ * `TICK_WINDOW_UNLOCKED` means the tick tracker has no lock, so the tick could
+ * come at any time. `TICK_WINDOW_TRANSITION` surrounds a predicted tick, while
+ * the hands may be moving. `TICK_WINDOW_STABLE` is the part of each period
+ * where the hands have settled, from which the best frame is chosen.
+ * `TICK_WINDOW_IDLE` is the rest of each period.
+ */
+typedef enum TickWindow
+{
+  TICK_WINDOW_UNLOCKED,
+  TICK_WINDOW_TRANSITION,
+  TICK_WINDOW_STABLE,
+  TICK_WINDOW_IDLE,
+} TickWindow;
+
 /**
  * @brief A structure containing a frame buffer and associated metadata.
+ *
+ * A frame in use is reference counted. Each stage or slot holding a frame
+ * owns a reference, and the frame only returns to the available frame queue
+ * once every reference has been released.
+ *
+ * The tile difference map holds the sum of absolute luma differences from the
+ * previous frame of each `FRAME_TILE_SIZE` square tile of the frame.
+ *
+ * The region of interest is the part of the frame measured by the difference
+ * stage, aligned to the tile grid. Tiles outside it are left at zero.
+ *
+ * The binary buffer holds the frame binarized to one bit per pixel, set where
+ * the pixel is dark, packed 64 pixels to a word.
+ *
+ * The capture time is on the monotonic clock, and for a source with a frame
+ * rate is the frame's time within the source rather than when it was read.
+ *
+ * The difference is a lower bound when the difference stage stopped counting
+ * once it was known to exceed the rising tick threshold.
+ *
+ * The sharpness is measured by the select stage only when needed, and is
+ * negative until then.
  */
 typedef struct Frame
 {
   cv::Mat frame_buffer;
-  unsigned int difference_absolute;
+  cv::Mat luma_buffer;
+  cv::Mat tile_difference_map;
+  cv::Mat binary_buffer;
+  cv::Rect region_of_interest;
+  FrameFormat format;
+  int driver_buffer_index;
+  unsigned int reference_count;
+  struct timespec capture_time;
+  unsigned long long difference_absolute;
   double difference_percentage;
+  int is_difference_lower_bound;
+  TickWindow tick_window;
+  double sharpness;
 } Frame;
 
+/**
+ * @brief The clock being captured.
+ *
+ * `CLOCK_MODE_1_HZ` is a clock that ticks once a second. `CLOCK_MODE_10_HZ` is
+ * a tick display that updates ten times a second. The sequencer's frequency
+ * and the services' periods follow from the tick frequency, capturing a fixed
+ * number of frames per tick and writing once per tick.
+ */
+typedef enum ClockMode
+{
+  CLOCK_MODE_1_HZ,
+  CLOCK_MODE_10_HZ,
+} ClockMode;
+
+/**
+ * @brief The transport used to pass frames between pipeline stages.
+ *
+ * `FRAME_QUEUE_BACKEND_MESSAGE_QUEUE` uses a POSIX message queue per hop.
+ * `FRAME_QUEUE_BACKEND_RING_BUFFER` uses an in-process lock-free ring buffer per
+ * hop, which only enters the kernel to sleep or wake.
+ */
+typedef enum FrameQueueBackend
+{
+  FRAME_QUEUE_BACKEND_MESSAGE_QUEUE,
+  FRAME_QUEUE_BACKEND_RING_BUFFER,
+} FrameQueueBackend;
+
+/**
+ * @brief A queue of frames between two pipeline stages, with a single
+ * producer and a single consumer.
+ */
+typedef struct FrameQueue
+{
+  const char *name;
+  FrameQueueBackend backend;
+  mqd_t message_queue;
+  SpscRingBuffer<Frame *, NUMBER_OF_FRAMES> ring_buffer;
+  int is_multiple_producer;
+  pthread_mutex_t producer_mutex;
+  long long maximum_send_nanoseconds;
+  long long maximum_receive_nanoseconds;
+} FrameQueue;
+
+/**
+ * @brief The source of captured frames.
+ *
+ * `CAPTURE_BACKEND_OPENCV` reads BGR frames through `cv::VideoCapture`, copying
+ * them into the frame arena. `CAPTURE_BACKEND_V4L2` streams frames in the
+ * camera's native format from memory-mapped driver buffers, without copying.
+ * `CAPTURE_BACKEND_SYNTHETIC` renders a deterministic analog clock.
+ * `CAPTURE_BACKEND_REPLAY` replays a directory of PPM and PGM images.
+ * `CAPTURE_BACKEND_RAW_FILE` streams frames from a memory-mapped file of raw
+ * frames, without copying.
+ */
+typedef enum CaptureBackend
+{
+  CAPTURE_BACKEND_OPENCV,
+  CAPTURE_BACKEND_V4L2,
+  CAPTURE_BACKEND_SYNTHETIC,
+  CAPTURE_BACKEND_REPLAY,
+  CAPTURE_BACKEND_RAW_FILE,
+} CaptureBackend;
+
+/**
+ * @brief How a capture backend that is not a camera advances through its
+ * frames.
+ *
+ * `FRAME_PACING_SEQUENCER` reads the next frame on every capture request.
+ * `FRAME_PACING_FREE_RUNNING` advances in real time at the backend's own frame
+ * rate, and each capture request waits for its next frame, like a camera.
+ */
+typedef enum FramePacing
+{
+  FRAME_PACING_SEQUENCER,
+  FRAME_PACING_FREE_RUNNING,
+} FramePacing;
+
+/**
+ * @brief A single contiguous region of memory holding the buffers of every
+ * frame.
+ */
+typedef struct FrameArena
+{
+  void *memory;
+  size_t size;
+  int is_huge_page_backed;
+} FrameArena;
+
+/**
+ * @brief A phase-locked estimate of when the clock ticks, from the times of
+ * the ticks detected so far. Times are in seconds on the monotonic clock.
+ *
+ * The tracker locks once enough consecutive ticks arrive a nominal period
+ * apart, and while locked it predicts the next tick, nudging its phase and
+ * period toward each tick detected. It loses lock when ticks stop arriving
+ * when predicted.
+ */
+typedef struct TickTracker
+{
+  pthread_mutex_t mutex;
+  double nominal_period;
+  double period;
+  double next_tick_time;
+  double previous_tick_time;
+  double previous_frame_time;
+  double frame_interval;
+  int is_locked;
+  unsigned int on_time_tick_count;
+  unsigned int missed_tick_count;
+  long long maximum_critical_section_nanoseconds;
+} TickTracker;
+
+/**
+ * @brief The difference percentages that start and end a tick, set by Select
+ * Frame and read by Difference Frame.
+ *
+ * A tick starts when a frame's difference rises to the rising threshold, and
+ * ends when a frame's difference falls below the falling threshold, which is
+ * never above the rising threshold.
+ */
+typedef struct TickThreshold
+{
+  std::atomic<double> rising_percentage;
+  std::atomic<double> falling_percentage;
+} TickThreshold;
+
 /**
  * @brief A struct containing all of the resources used by the real-time system
  * for processing frames.
  */
 typedef struct FramePipeline
 {
+  const FrameQueueBackend frame_queue_backend;
+  const int use_huge_pages;
+  const CaptureBackend capture_backend;
+  const FramePacing frame_pacing;
+  const int difference_worker_count;
+  const int difference_worker_cpus[MAXIMUM_DIFFERENCE_WORKERS];
+  const double tick_frequency;
+  const int write_completion_cpu;
+  const int region_detection_cpu;
+  void (*frame_release_function)(struct FramePipeline *, Frame *);
+  FrameArena frame_arena;
+  cv::Size frame_size;
+  TickTracker tick_tracker;
+  TickThreshold tick_threshold;
+  std::atomic<int> is_write_backpressured;
   Frame frames[NUMBER_OF_FRAMES];
-  mqd_t available_frame_queue;
-  mqd_t captured_frame_queue;
-  mqd_t difference_frame_queue;
-  mqd_t selected_frame_queue;
+  FrameQueue available_frame_queue;
+  FrameQueue captured_frame_queue;
+  FrameQueue difference_frame_queue;
+  FrameQueue selected_frame_queue;
   struct mq_attr message_queue_attributes;
 } FramePipeline;
 
+/**
+ * @brief The scheduling policy the services run under.
+ *
+ * `EXECUTION_MODE_FIFO` runs each service under `SCHED_FIFO` with a
+ * rate-monotonic priority, released by the sequencer. `EXECUTION_MODE_DEADLINE`
+ * runs each service under `SCHED_DEADLINE`, where the kernel releases each
+ * request and the sequencer only starts and stops the services.
+ */
+typedef enum ExecutionMode
+{
+  EXECUTION_MODE_FIFO,
+  EXECUTION_MODE_DEADLINE,
+} ExecutionMode;
+
 /**
  * @brief A struct containing the properties of a single real-time service.
  */
@@ -50,6 +272,7 @@ typedef struct Service
   const unsigned int id;
   const char *name;
   const int period;
+  const int phase;
   const int cpu;
   int exit_flag;
   FramePipeline *frame_pipeline;
@@ -64,8 +287,62 @@ typedef struct Service
   struct sched_param schedule_parameters;
   struct timespec work_start_time;
   struct timespec work_complete_time;
+  unsigned long long missed_release_count;
+  long long deadline_nanoseconds;
+  struct timespec release_times[RELEASE_TIME_QUEUE_LENGTH];
+  unsigned long long release_count;
+  Histogram execution_time_histogram;
+  Histogram response_time_histogram;
+  Histogram work_time_histogram;
+  unsigned long long deadline_miss_count;
+  unsigned long long release_overrun_count;
+  long long wcet_nanoseconds;
+  ExecutionMode execution_mode;
+  long long runtime_nanoseconds;
 } Service;
 
+/**
+ * @brief The mechanism used to release service requests.
+ *
+ * `SEQUENCER_MODE_SIGNAL` runs the sequencer from a `SIGALRM` handler driven by
+ * a POSIX interval timer. `SEQUENCER_MODE_THREAD` runs the sequencer on its own
+ * real-time thread, sleeping until each absolute release time.
+ * `SEQUENCER_MODE_TIMERFD` runs the sequencer on its own real-time thread as an
+ * epoll event loop over a `timerfd`, detecting any missed ticks.
+ */
+typedef enum SequencerMode
+{
+  SEQUENCER_MODE_SIGNAL,
+  SEQUENCER_MODE_THREAD,
+  SEQUENCER_MODE_TIMERFD,
+} SequencerMode;
+
+/**
+ * @brief How the `timerfd` sequencer handles ticks it missed while it was
+ * unable to run.
+ *
+ * `CATCH_UP_POLICY_SKIP` drops the missed releases and stays in phase with the
+ * timer. `CATCH_UP_POLICY_BURST` issues every missed release immediately.
+ * `CATCH_UP_POLICY_SHIFT_PHASE` issues only the next release and shifts the
+ * remainder of the schedule later by the missed ticks.
+ */
+typedef enum CatchUpPolicy
+{
+  CATCH_UP_POLICY_SKIP,
+  CATCH_UP_POLICY_BURST,
+  CATCH_UP_POLICY_SHIFT_PHASE,
+} CatchUpPolicy;
+
+/**
+ * @brief What to do when the startup schedulability analysis cannot guarantee
+ * every deadline.
+ */
+typedef enum SchedulabilityPolicy
+{
+  SCHEDULABILITY_POLICY_WARN,
+  SCHEDULABILITY_POLICY_ENFORCE,
+} SchedulabilityPolicy;
+
 /**
  * @brief A struct describing a schedule of real-time services.
  */
@@ -74,10 +351,27 @@ typedef struct Schedule
   const double frequency;
   const unsigned long long maximum_iterations;
   unsigned long long iteration_counter;
+  unsigned int minor_frame;
   const int sequencer_cpu;
+  const SequencerMode sequencer_mode;
+  const CatchUpPolicy catch_up_policy;
+  const SchedulabilityPolicy schedulability_policy;
+  const ExecutionMode execution_mode;
   Service services[NUMBER_OF_SERVICES];
+  unsigned int hyperperiod;
+  unsigned int release_table[MAXIMUM_HYPERPERIOD];
   timer_t timer;
   struct itimerspec timer_interval;
+  pthread_t sequencer_thread_descriptor;
+  pthread_attr_t sequencer_thread_attributes;
+  struct sched_param sequencer_schedule_parameters;
+  struct timespec sequencer_start_time;
+  int timer_file_descriptor;
+  int epoll_file_descriptor;
+  unsigned long long missed_tick_count;
+  Histogram sequencer_histogram;
+  long long sequencer_wcet_nanoseconds;
+  long long critical_section_nanoseconds;
 } Schedule;
 
 #endif
@@ -5,88 +5,172 @@
  * @date 2022
  */
 
-#include <iostream>
-#include <mqueue.h>
-#include <opencv2/core.hpp>
-#include <opencv2/imgproc.hpp>
-#include <opencv2/highgui.hpp>
-#include <opencv2/videoio.hpp>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include "../frame_queue.hpp"
 #include "../sequencer.hpp"
 #include "../utils/error.h"
 #include "../utils/log.h"
 #include "../utils/time.h"
 #include "capture_frame.h"
+#include "opencv_capture.h"
+#include "raw_file_capture.h"
+#include "replay_capture.h"
+#include "synthetic_capture.h"
+#include "v4l2_capture.h"
 
-cv::VideoCapture video_capture;
+/**
+ * @brief A source of frames for the Capture Frame service.
+ *
+ * A source with a frame rate produces the frame with a given index on demand.
+ * A source without one is a camera, which produces its frames in real time.
+ */
+typedef struct FrameSource
+{
+  const char *name;
+  const double frames_per_second;
+  void (*setup_function)(FramePipeline *);
+  void (*teardown_function)(FramePipeline *);
+  int (*read_function)(FramePipeline *, Frame *, unsigned long long frame_index);
+} FrameSource;
+
+/**
+ * @brief The frame sources, in the order of `CaptureBackend`.
+ */
+const FrameSource frame_sources[] = {
+    {
+        .name = "OpenCV",
+        .frames_per_second = 0,
+        .setup_function = opencv_capture_setup,
+        .teardown_function = opencv_capture_teardown,
+        .read_function = opencv_capture_read,
+    },
+    {
+        .name = "V4L2",
+        .frames_per_second = 0,
+        .setup_function = v4l2_capture_setup,
+        .teardown_function = v4l2_capture_teardown,
+        .read_function = v4l2_capture_read,
+    },
+    {
+        .name = "Synthetic",
+        .frames_per_second = SYNTHETIC_FRAMES_PER_SECOND,
+        .setup_function = synthetic_capture_setup,
+        .teardown_function = synthetic_capture_teardown,
+        .read_function = synthetic_capture_read,
+    },
+    {
+        .name = "Replay",
+        .frames_per_second = REPLAY_FRAMES_PER_SECOND,
+        .setup_function = replay_capture_setup,
+        .teardown_function = replay_capture_teardown,
+        .read_function = replay_capture_read,
+    },
+    {
+        .name = "Raw File",
+        .frames_per_second = RAW_FRAMES_PER_SECOND,
+        .setup_function = raw_file_capture_setup,
+        .teardown_function = raw_file_capture_teardown,
+        .read_function = raw_file_capture_read,
+    },
+};
+
+const FrameSource *frame_source;
+struct timespec frame_source_start_time;
+unsigned long long next_frame_index;
+
+/**
+ * @brief Get the index of the next frame to read from the frame source.
+ *
+ * When paced by the sequencer, each request reads the source's next frame.
+ * When free-running, the source advances in real time at its own frame rate,
+ * and each request waits for the source's next frame, like a camera.
+ */
+unsigned long long get_next_frame_index(FramePipeline *frame_pipeline)
+{
+  if (frame_pipeline->frame_pacing == FRAME_PACING_SEQUENCER || frame_source->frames_per_second <= 0)
+    return next_frame_index++;
+
+  // Find the next frame due after now, skipping any that were missed.
+  struct timespec current_time;
+  get_current_monotonic_time(&current_time);
+  double elapsed_time = get_elapsed_time_in_seconds(&frame_source_start_time, &current_time);
+  unsigned long long frame_index = (unsigned long long)floor(elapsed_time * frame_source->frames_per_second) + 1;
+  if (frame_index < next_frame_index)
+    frame_index = next_frame_index;
+  next_frame_index = frame_index + 1;
+
+  // Wait for it.
+  struct timespec frame_time = frame_source_start_time;
+  add_nanoseconds_to_timespec(&frame_time, llround(frame_index * NANOSECONDS_PER_SECOND / frame_source->frames_per_second));
+  while ((errno = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &frame_time, NULL)) == EINTR)
+    ;
+  if (errno)
+    print_with_errno_and_exit("clock_nanosleep()");
+
+  return frame_index;
+}
 
 /**
- * @brief Starts up the camera, warms up the frame buffers in memory, and
- * initalizes the queue of frames available for writing to.
+ * @brief Starts up the frame source, which lays out the frame buffers in the
+ * frame arena, and initalizes the queue of frames available for writing to.
  */
 void capture_frame_setup(FramePipeline *frame_pipeline)
 {
-  // Start the camera.
-  if (!video_capture.open(0))
-    print_error_and_exit("Error at `video_capture.open()`\n");
+  frame_source = &frame_sources[frame_pipeline->capture_backend];
+  write_log("Capture Frame: Frame Source: %s", frame_source->name);
 
-  // Warm up each frame buffer.
+  // Start the frame source.
   for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
-  {
-    Frame *frame = &frame_pipeline->frames[index];
+    frame_pipeline->frames[index].driver_buffer_index = -1;
+  (frame_source->setup_function)(frame_pipeline);
+  get_current_monotonic_time(&frame_source_start_time);
 
-    // Write a frame to the buffer. (I think this will initialize memory
-    // allocation.)
-    while (!video_capture.read(frame->frame_buffer))
-    {
-      std::cout << "No frame.\n";
-      cv::waitKey(25);
-    }
-
-    // Enqueue the frame.
-    attempt(mq_send(
-                frame_pipeline->available_frame_queue,
-                (const char *)&frame,
-                sizeof(Frame *),
-                0),
-            "mq_send() available_frame_queue in capture_frame");
-  }
+  // Enqueue each frame.
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+    enqueue_frame(&frame_pipeline->available_frame_queue, &frame_pipeline->frames[index]);
 }
 
 /**
- * @brief Shuts down the camera.
+ * @brief Shuts down the frame source.
  */
 void capture_frame_teardown(FramePipeline *frame_pipeline)
 {
-  // Shut down the camera.
-  video_capture.release();
+  (frame_source->teardown_function)(frame_pipeline);
 }
 
 /**
- * @brief Copies one frame from the camera into the next availablle frame
- * buffer.
+ * @brief Reads one frame from the frame source into the next available frame.
  */
 void capture_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter)
 {
   // Dequeue the next available frame.
-  Frame *frame;
-  attempt(
-      mq_receive(
-          frame_pipeline->available_frame_queue,
-          (char *)&frame,
-          sizeof(Frame *),
-          NULL),
-      "mq_receive() available_frame_queue in capture_frame");
+  Frame *frame = allocate_frame(frame_pipeline);
+
+  // Wait for the source's next frame, if it is free-running.
+  unsigned long long frame_index = get_next_frame_index(frame_pipeline);
 
   // Start request timer.
   write_log_with_timer("Service: %i, Service Name: %s, Request: %u, BEGIN", service->id, service->name, request_counter);
   get_current_monotonic_raw_time(&service->work_start_time);
 
-  // Capture a frame.
-  if (!video_capture.read(frame->frame_buffer))
+  // Capture a frame. Without one the frame has no contents, so drop it.
+  if (!(frame_source->read_function)(frame_pipeline, frame, frame_index))
+  {
+    write_log_with_timer("Service: %i, Service Name: %s, Request: %u, NO FRAME", service->id, service->name, request_counter);
+    release_frame(frame_pipeline, frame);
+    return;
+  }
+
+  // Timestamp the frame, by its time within the source if it has a frame rate.
+  if (frame_source->frames_per_second > 0)
   {
-    std::cout << "No frame.\n";
-    cv::waitKey(25);
+    frame->capture_time = frame_source_start_time;
+    add_nanoseconds_to_timespec(&frame->capture_time, llround(frame_index * NANOSECONDS_PER_SECOND / frame_source->frames_per_second));
   }
+  else
+    get_current_monotonic_time(&frame->capture_time);
 
   // End request timer.
   get_current_monotonic_raw_time(&service->work_complete_time);
@@ -97,12 +181,6 @@ void capture_frame(FramePipeline *frame_pipeline, Service *service, unsigned int
       request_counter,
       get_elapsed_time_in_seconds(&service->work_start_time, &service->work_complete_time));
 
-  // Enqueue the captured frame.
-  attempt(
-      mq_send(
-          frame_pipeline->captured_frame_queue,
-          (const char *)&frame,
-          sizeof(Frame *),
-          0),
-      "mq_send() captured_frame_queue in capture_frame");
+  // Enqueue the captured frame, passing on this stage's reference.
+  enqueue_frame(&frame_pipeline->captured_frame_queue, frame);
 }
@@ -5,54 +5,335 @@
  * @date 2022
  */
 
-#include <mqueue.h>
+#include <algorithm>
+#include <math.h>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
-#include <unistd.h>
+#include "../binary_frame.hpp"
+#include "../frame_queue.hpp"
+#include "../luma.hpp"
+#include "../region_of_interest.hpp"
 #include "../sequencer.hpp"
+#include "../tick_tracker.hpp"
+#include "../worker_pool.hpp"
 #include "../utils/error.h"
 #include "../utils/log.h"
 #include "../utils/time.h"
 #include "difference_frame.h"
+#include "select_frame.h"
 
 #define DISPLAY_FRAMES FALSE
+#define DIFFERENCE_MODE DIFFERENCE_MODE_FULL
+#define DIFFERENCE_REFERENCE DIFFERENCE_REFERENCE_PREVIOUS_FRAME
+#define BACKGROUND_LEARNING_RATE_SHIFT (3)
+#define COARSE_DIFFERENCE_DECIMATION (4)
+#define COARSE_DIFFERENCE_MARGIN (0.5)
+#define BINARY_THRESHOLD_ADAPTIVE TRUE
+#define BINARY_FIXED_THRESHOLD (128)
+#define DETECT_REGION_OF_INTEREST FALSE
+#define REGION_OF_INTEREST_REVALIDATION_PERIOD (300)
+#define GATE_BY_TICK_WINDOW FALSE
 
-cv::Mat *previous_frame_buffer;
-cv::Mat difference_frame_buffer;
-int is_initialized = FALSE;
-unsigned int difference_absolute, max_difference_absolute;
+static_assert(
+    DIFFERENCE_REFERENCE == DIFFERENCE_REFERENCE_PREVIOUS_FRAME || DIFFERENCE_MODE == DIFFERENCE_MODE_FULL,
+    "The background model is only implemented for DIFFERENCE_MODE_FULL");
+
+cv::Mat cached_luma_buffer, displayed_luma_buffer, difference_frame_buffer;
+cv::Mat background_model_buffer;
+int is_cached_luma_valid;
+WorkerPool difference_worker_pool;
+unsigned long long max_difference_absolute;
+
+Frame *previous_frame;
+cv::Mat sampled_luma_buffer, previous_sampled_luma_buffer;
+unsigned long long max_sampled_difference_absolute;
+unsigned int coarse_stable_count, coarse_changed_count, refined_count, gated_count;
+
+int binary_threshold;
+unsigned long long pixel_count;
+
+cv::Rect region_of_interest;
+unsigned int frames_since_region_of_interest_validation;
+RegionDetector region_detector;
 
 /**
  * @brief Calculate the percentage of the given value relative to the given
  * maximum value.
  */
-double get_percentage(unsigned int value, unsigned int max_value)
+double get_percentage(unsigned long long value, unsigned long long max_value)
 {
   return ((double)value / (double)max_value) * 100.0;
 }
 
+/**
+ * @brief Measure only the given region of each frame from now on, and compute
+ * the maximum absolute differences within it.
+ */
+void set_region_of_interest(const cv::Rect &region)
+{
+  region_of_interest = region;
+  pixel_count = (unsigned long long)region.width * region.height;
+  max_difference_absolute = pixel_count * 255;
+  max_sampled_difference_absolute =
+      (unsigned long long)(region.width / COARSE_DIFFERENCE_DECIMATION) *
+      (region.height / COARSE_DIFFERENCE_DECIMATION) * 255;
+}
+
+/**
+ * @brief Forget the previous frame, so that the next frame is treated as the
+ * very first.
+ */
+void reset_previous_frame(FramePipeline *frame_pipeline)
+{
+  is_cached_luma_valid = FALSE;
+  if (previous_frame != NULL)
+    release_frame(frame_pipeline, previous_frame);
+  previous_frame = NULL;
+}
+
+/**
+ * @brief Move the region of interest to the clock face, once the region
+ * detector has located it. If the face could not be found, the region of
+ * interest is kept as it is.
+ *
+ * Moving the region of interest restarts the comparison, since the previous
+ * frame was only measured within the old region.
+ */
+void collect_region_of_interest(FramePipeline *frame_pipeline, Frame *frame)
+{
+  cv::Rect clock_face_region;
+  RegionDetectionState state = get_region_detection_result(&region_detector, &clock_face_region);
+  if (state == REGION_DETECTION_STATE_NOT_FOUND)
+    write_log_with_timer("Difference Frame - CLOCK FACE NOT FOUND, KEEPING REGION OF INTEREST");
+  if (state != REGION_DETECTION_STATE_FOUND || clock_face_region == region_of_interest)
+    return;
+
+  write_log_with_timer(
+      "Difference Frame - REGION OF INTEREST MOVED: %ix%i at (%i, %i), %.1f%% of the frame",
+      clock_face_region.width,
+      clock_face_region.height,
+      clock_face_region.x,
+      clock_face_region.y,
+      get_percentage((unsigned long long)clock_face_region.width * clock_face_region.height, frame->frame_buffer.total()));
+  set_region_of_interest(clock_face_region);
+  reset_previous_frame(frame_pipeline);
+}
+
 /**
  * @brief Initialize frame measurements required to calculate difference
  * percentages.
  */
 void difference_frame_setup(FramePipeline *frame_pipeline)
 {
-  // Wait for the first frame to receive warmup data.
-  cv::Mat *warmup_frame_buffer = &frame_pipeline->frames[0].frame_buffer;
-  while (warmup_frame_buffer->cols == 0)
-    usleep(MICROSECONDS_PER_SECOND);
-
-  // Compute the maximum absolute difference.
-  cv::cvtColor(*warmup_frame_buffer, *warmup_frame_buffer, CV_BGR2GRAY);
-  max_difference_absolute = (*warmup_frame_buffer).cols * (*warmup_frame_buffer).rows * 255;
+  // Capture Frame has laid out the frames' buffers by now.
+  const cv::Size &frame_size = frame_pipeline->frame_size;
+
+  // Allocate the cache of the previous frame's luma, or the background model,
+  // and start the workers that share the full difference with this service.
+  if (DIFFERENCE_MODE == DIFFERENCE_MODE_FULL)
+  {
+    if (DIFFERENCE_REFERENCE == DIFFERENCE_REFERENCE_BACKGROUND_MODEL)
+      background_model_buffer.create(frame_size.height, frame_size.width, CV_16SC1);
+    else
+      cached_luma_buffer.create(frame_size.height, frame_size.width, CV_8UC1);
+    initialize_worker_pool(
+        &difference_worker_pool,
+        frame_pipeline->difference_worker_count,
+        frame_pipeline->difference_worker_cpus);
+  }
+  is_cached_luma_valid = FALSE;
+
+  // Measure the whole frame until the clock face is located, and start
+  // searching for it off the real-time CPUs.
+  set_region_of_interest(cv::Rect(0, 0, frame_size.width, frame_size.height));
+  frames_since_region_of_interest_validation = 0;
+  if (DETECT_REGION_OF_INTEREST)
+    initialize_region_detector(
+        &region_detector,
+        frame_size.height,
+        frame_size.width,
+        frame_pipeline->region_detection_cpu);
+
+  // The binary threshold adapts from here, if indicated.
+  binary_threshold = BINARY_FIXED_THRESHOLD;
+
+  // Choose the differencing kernels for this CPU.
+  initialize_luma_kernels();
+  initialize_binary_kernels();
 }
 
 /**
- * @brief Does nothing.
+ * @brief Frees the cache of the previous frame's luma and the background
+ * model, stops the region detector, releases the previous frame, and reports
+ * how often the coarse difference sufficed.
  */
 void difference_frame_teardown(FramePipeline *frame_pipeline)
 {
+  if (DIFFERENCE_MODE == DIFFERENCE_MODE_FULL)
+  {
+    cached_luma_buffer.release();
+    background_model_buffer.release();
+    uninitialize_worker_pool(&difference_worker_pool);
+  }
+  if (DETECT_REGION_OF_INTEREST)
+    uninitialize_region_detector(&region_detector);
+  reset_previous_frame(frame_pipeline);
+
+  if (DIFFERENCE_MODE == DIFFERENCE_MODE_COARSE_TO_FINE)
+    write_log(
+        "Difference Frame - Coarse Stable: %u, Coarse Changed: %u, Refined: %u, Gated: %u",
+        coarse_stable_count,
+        coarse_changed_count,
+        refined_count,
+        gated_count);
+}
+
+/**
+ * @brief Measure a frame's difference at every pixel, against either the
+ * cached luma of the previous frame or the background model.
+ */
+void measure_full_difference(FramePipeline *frame_pipeline, Frame *frame)
+{
+  // Leave the color frame intact and cache this frame's luma in place of the
+  // previous frame's, or blend it into the background model. The very first
+  // frame has nothing to compare to, so is treated as unchanged, and becomes
+  // the whole model.
+  if (DIFFERENCE_REFERENCE == DIFFERENCE_REFERENCE_BACKGROUND_MODEL)
+    frame->difference_absolute = difference_frame_against_background_model(
+        frame,
+        background_model_buffer,
+        is_cached_luma_valid ? BACKGROUND_LEARNING_RATE_SHIFT : 0,
+        &difference_worker_pool);
+  else
+    frame->difference_absolute = difference_frame_against_luma_cache(frame, cached_luma_buffer, &difference_worker_pool);
+  if (!is_cached_luma_valid)
+  {
+    frame->difference_absolute = 0;
+    is_cached_luma_valid = TRUE;
+  }
+  frame->difference_percentage = get_percentage(frame->difference_absolute, max_difference_absolute);
+
+  // Restart the background model from a frame that ticked, so that the tick
+  // is measured once rather than fading out over the following frames.
+  if (DIFFERENCE_REFERENCE == DIFFERENCE_REFERENCE_BACKGROUND_MODEL &&
+      frame->difference_percentage >= frame_pipeline->tick_threshold.rising_percentage.load(std::memory_order_relaxed))
+  {
+    write_log_with_timer("Difference Frame - BACKGROUND MODEL RESET");
+    reset_background_model(frame, background_model_buffer, &difference_worker_pool);
+  }
+}
+
+/**
+ * @brief Measure a frame's difference from the previous frame from a decimated
+ * sample of each, refining at every pixel only when the sample cannot tell
+ * which side of the tick thresholds the frame falls on.
+ *
+ * A difference well clear of both thresholds is estimated from the sample
+ * alone. A refined difference stops accumulating as soon as it exceeds the
+ * rising threshold, so above it it is only a lower bound.
+ *
+ * While the tick tracker is locked, a frame outside the predicted transition
+ * and stable windows is never refined, since no tick is expected and it will
+ * not be selected. The sample still catches a tick that comes anyway.
+ */
+void measure_coarse_to_fine_difference(FramePipeline *frame_pipeline, Frame *frame)
+{
+  // The very first frame has nothing to compare to, so is compared to itself.
+  sample_frame_luma(frame, sampled_luma_buffer, COARSE_DIFFERENCE_DECIMATION);
+  if (previous_frame == NULL)
+  {
+    retain_frame(frame);
+    previous_frame = frame;
+    sampled_luma_buffer.copyTo(previous_sampled_luma_buffer);
+  }
+
+  // Estimate the difference from the samples.
+  unsigned long long sampled_difference_absolute = difference_sampled_luma_by_tile(
+      previous_sampled_luma_buffer,
+      sampled_luma_buffer,
+      COARSE_DIFFERENCE_DECIMATION,
+      frame);
+  double coarse_difference_percentage = get_percentage(sampled_difference_absolute, max_sampled_difference_absolute);
+  std::swap(sampled_luma_buffer, previous_sampled_luma_buffer);
+
+  double rising_threshold_percentage = frame_pipeline->tick_threshold.rising_percentage.load(std::memory_order_relaxed);
+  double falling_threshold_percentage = frame_pipeline->tick_threshold.falling_percentage.load(std::memory_order_relaxed);
+
+  const char *measurement;
+  if (GATE_BY_TICK_WINDOW && frame->tick_window == TICK_WINDOW_IDLE)
+  {
+    // No tick is expected, so the estimate will do.
+    measurement = "GATED";
+    ++gated_count;
+    frame->difference_percentage = coarse_difference_percentage;
+    frame->difference_absolute = llround(coarse_difference_percentage / 100.0 * max_difference_absolute);
+  }
+  else if (coarse_difference_percentage < falling_threshold_percentage * (1.0 - COARSE_DIFFERENCE_MARGIN) ||
+           coarse_difference_percentage > rising_threshold_percentage * (1.0 + COARSE_DIFFERENCE_MARGIN))
+  {
+    // The estimate is clearly stable or clearly changed.
+    if (coarse_difference_percentage < falling_threshold_percentage)
+    {
+      measurement = "CLEARLY STABLE";
+      ++coarse_stable_count;
+    }
+    else
+    {
+      measurement = "CLEARLY CHANGED";
+      ++coarse_changed_count;
+    }
+    frame->difference_percentage = coarse_difference_percentage;
+    frame->difference_absolute = llround(coarse_difference_percentage / 100.0 * max_difference_absolute);
+  }
+  else
+  {
+    // The estimate is too close to call, so compare every pixel, up to the
+    // rising threshold.
+    measurement = "REFINED";
+    ++refined_count;
+    unsigned long long threshold_absolute = (unsigned long long)ceil(rising_threshold_percentage / 100.0 * max_difference_absolute);
+    frame->difference_absolute = difference_frames(previous_frame, frame, threshold_absolute);
+    frame->difference_percentage = get_percentage(frame->difference_absolute, max_difference_absolute);
+    frame->is_difference_lower_bound = frame->difference_absolute > threshold_absolute;
+  }
+
+  write_log_with_timer("Difference Frame - Coarse Percentage: %f, %s", coarse_difference_percentage, measurement);
+
+  // Update the previous frame, holding it until the next frame is compared.
+  retain_frame(frame);
+  release_frame(frame_pipeline, previous_frame);
+  previous_frame = frame;
+}
+
+/**
+ * @brief Measure a frame's difference from the previous frame as the number
+ * of pixels that flipped between dark and light.
+ *
+ * An adaptive threshold is the previous frame's mean luma, which tracks
+ * changes in lighting.
+ */
+void measure_binary_difference(FramePipeline *frame_pipeline, Frame *frame)
+{
+  unsigned long long luma_sum = binarize_frame(frame, binary_threshold);
+  if (BINARY_THRESHOLD_ADAPTIVE)
+    binary_threshold = (int)(luma_sum / pixel_count);
+
+  // The very first frame has nothing to compare to, so is compared to itself.
+  if (previous_frame == NULL)
+  {
+    retain_frame(frame);
+    previous_frame = frame;
+  }
+
+  frame->difference_absolute = difference_binary_frames(previous_frame, frame);
+  frame->difference_percentage = get_percentage(frame->difference_absolute, pixel_count);
+  write_log_with_timer("Difference Frame - Binary Threshold: %i", binary_threshold);
+
+  // Update the previous frame, holding it until the next frame is compared.
+  retain_frame(frame);
+  release_frame(frame_pipeline, previous_frame);
+  previous_frame = frame;
 }
 
 /**
@@ -62,49 +343,58 @@ void difference_frame_teardown(FramePipeline *frame_pipeline)
 void difference_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter)
 {
   // Dequeue the next captured frame.
-  Frame *frame;
-  attempt(
-      mq_receive(
-          frame_pipeline->captured_frame_queue,
-          (char *)&frame,
-          sizeof(Frame *),
-          NULL),
-      "mq_receive() captured_frame_queue in difference_frame");
+  Frame *frame = dequeue_frame(&frame_pipeline->captured_frame_queue);
 
   // Start request timer.
   write_log_with_timer("Service: %i, Service Name: %s, Request: %u, BEGIN", service->id, service->name, request_counter);
   get_current_monotonic_raw_time(&service->work_start_time);
 
-  // If this is the very first frame, initialize the previous frame buffer
-  // with this same frame.
-  if (!is_initialized)
+  // Locate the clock face from the first frame, and periodically after that.
+  // The search runs on the region detector, and its result applies from the
+  // first frame after it finishes.
+  if (DETECT_REGION_OF_INTEREST)
   {
-    previous_frame_buffer = &frame->frame_buffer;
-    is_initialized = TRUE;
+    collect_region_of_interest(frame_pipeline, frame);
+    if (frames_since_region_of_interest_validation != 0 || request_region_detection(&region_detector, frame))
+      frames_since_region_of_interest_validation = (frames_since_region_of_interest_validation + 1) % REGION_OF_INTEREST_REVALIDATION_PERIOD;
   }
+  frame->region_of_interest = region_of_interest;
 
-  // Convert the frame to grayscale.
-  cv::cvtColor(frame->frame_buffer, frame->frame_buffer, CV_BGR2GRAY);
+  // Place the frame relative to the predicted ticks.
+  frame->tick_window = get_tick_window(&frame_pipeline->tick_tracker, &frame->capture_time);
+  write_log_with_timer("Difference Frame - Tick Window: %s", get_tick_window_name(frame->tick_window));
 
   // Compute the difference from the previous frame.
-  cv::absdiff(*previous_frame_buffer, frame->frame_buffer, difference_frame_buffer);
-  frame->difference_absolute = (unsigned int)cv::sum(difference_frame_buffer)[0];
-  frame->difference_percentage = get_percentage(frame->difference_absolute, max_difference_absolute);
+  frame->is_difference_lower_bound = FALSE;
+  switch (DIFFERENCE_MODE)
+  {
+  case DIFFERENCE_MODE_FULL:
+    measure_full_difference(frame_pipeline, frame);
+    break;
+  case DIFFERENCE_MODE_COARSE_TO_FINE:
+    measure_coarse_to_fine_difference(frame_pipeline, frame);
+    break;
+  case DIFFERENCE_MODE_BINARY:
+    measure_binary_difference(frame_pipeline, frame);
+    break;
+  }
 
   if (DISPLAY_FRAMES)
   {
     // Draw frames to the screen for debugging.
+    convert_frame_to_luma(frame);
+    if (displayed_luma_buffer.empty())
+      frame->luma_buffer.copyTo(displayed_luma_buffer);
+    cv::absdiff(displayed_luma_buffer, frame->luma_buffer, difference_frame_buffer);
     cv::putText(difference_frame_buffer, std::to_string(frame->difference_percentage), cvPoint(500, 30), cv::FONT_HERSHEY_COMPLEX_SMALL, 0.8, cvScalar(200, 200, 250), 1, CV_AA);
-    cv::imshow("Grayscale Frame", frame->frame_buffer);
+    cv::imshow("Grayscale Frame", frame->luma_buffer);
     cv::imshow("Difference Frame", difference_frame_buffer);
+    frame->luma_buffer.copyTo(displayed_luma_buffer);
     cvWaitKey(100);
   }
 
   write_log_with_timer("Difference Frame - Percentage: %f", frame->difference_percentage);
 
-  // Update the previous frame buffer.
-  previous_frame_buffer = &frame->frame_buffer;
-
   // End request timer.
   get_current_monotonic_raw_time(&service->work_complete_time);
   write_log_with_timer(
@@ -115,11 +405,5 @@ void difference_frame(FramePipeline *frame_pipeline, Service *service, unsigned
       get_elapsed_time_in_seconds(&service->work_start_time, &service->work_complete_time));
 
   // Enqueue the difference frame.
-  attempt(
-      mq_send(
-          frame_pipeline->difference_frame_queue,
-          (const char *)&frame,
-          sizeof(Frame *),
-          0),
-      "mq_send() difference_frame_queue in difference_frame");
+  enqueue_frame(&frame_pipeline->difference_frame_queue, frame);
 }
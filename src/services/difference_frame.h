@@ -3,6 +3,44 @@
 
 #include "../sequencer.hpp"
 
+/**
+ * @brief How the difference between consecutive frames is measured.
+ *
+ * `DIFFERENCE_MODE_FULL` compares every pixel of each frame, a tile at a time
+ * in parallel across the difference workers.
+ * `DIFFERENCE_MODE_COARSE_TO_FINE` first compares a decimated sample of each
+ * frame, and only compares every pixel when the sample is too close to the
+ * tick detection threshold to call, stopping once the threshold is exceeded.
+ * Its tile difference map is estimated from the sample.
+ * `DIFFERENCE_MODE_BINARY` binarizes each frame to one bit per pixel and
+ * counts the pixels that flipped, so its differences are in pixels rather than
+ * luma levels.
+ */
+typedef enum DifferenceMode
+{
+  DIFFERENCE_MODE_FULL,
+  DIFFERENCE_MODE_COARSE_TO_FINE,
+  DIFFERENCE_MODE_BINARY,
+} DifferenceMode;
+
+/**
+ * @brief What each frame is compared to in `DIFFERENCE_MODE_FULL`. The other
+ * modes always compare each frame to the one before it.
+ *
+ * `DIFFERENCE_REFERENCE_PREVIOUS_FRAME` compares each frame to the one before
+ * it, so sensor noise and gradual lighting changes count toward the
+ * difference.
+ * `DIFFERENCE_REFERENCE_BACKGROUND_MODEL` compares each frame to a running
+ * average of the frames since the last tick, which averages out the noise and
+ * follows gradual lighting changes. The model is reset to the frame on each
+ * tick, so the hands' new positions do not linger as differences.
+ */
+typedef enum DifferenceReference
+{
+  DIFFERENCE_REFERENCE_PREVIOUS_FRAME,
+  DIFFERENCE_REFERENCE_BACKGROUND_MODEL,
+} DifferenceReference;
+
 void difference_frame_setup(FramePipeline *frame_pipeline);
 void difference_frame_teardown(FramePipeline *frame_pipeline);
 void difference_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter);
@@ -0,0 +1,131 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <iostream>
+#include <string.h>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/videoio.hpp>
+#include "../frame_arena.hpp"
+#include "../sequencer.hpp"
+#include "../utils/error.h"
+#include "../utils/log.h"
+#include "opencv_capture.h"
+
+cv::VideoCapture video_capture;
+cv::Mat raw_frame_buffer;
+FrameFormat capture_format;
+
+/**
+ * @brief Ask the camera for its native YUYV frames, unconverted. Returns
+ * `TRUE` if the camera agreed.
+ */
+int request_native_yuyv_frames()
+{
+  if (!video_capture.set(CV_CAP_PROP_FOURCC, CV_FOURCC('Y', 'U', 'Y', 'V')))
+    return FALSE;
+  if (!video_capture.set(CV_CAP_PROP_CONVERT_RGB, FALSE))
+    return FALSE;
+  return video_capture.get(CV_CAP_PROP_CONVERT_RGB) == FALSE;
+}
+
+/**
+ * @brief Read the camera's next frame into the given frame buffer. Returns
+ * `TRUE` if a frame was captured.
+ *
+ * Unconverted frames arrive from OpenCV as a flat run of bytes, so they are
+ * read aside and copied into the frame buffer's YUYV layout.
+ */
+int read_camera_frame(cv::Mat &frame_buffer)
+{
+  if (capture_format == FRAME_FORMAT_BGR)
+    return video_capture.read(frame_buffer);
+
+  if (!video_capture.read(raw_frame_buffer))
+    return FALSE;
+  size_t frame_size = (size_t)frame_buffer.rows * frame_buffer.cols * 2;
+  if (!raw_frame_buffer.isContinuous() || raw_frame_buffer.total() * raw_frame_buffer.elemSize() != frame_size)
+    print_error_and_exit("Camera YUYV frame size changed during capture\n");
+  memcpy(frame_buffer.data, raw_frame_buffer.data, frame_size);
+  return TRUE;
+}
+
+/**
+ * @brief Starts up the camera, lays out the frame buffers in the frame arena
+ * to match its format, and warms them up.
+ *
+ * If `OPENCV_CAPTURE_NATIVE_YUYV` is set and the camera supports it, frames are
+ * kept in the camera's YUYV format, so that only frames selected for writing
+ * are ever converted to BGR.
+ */
+void opencv_capture_setup(FramePipeline *frame_pipeline)
+{
+  // Start the camera.
+  if (!video_capture.open(0))
+    print_error_and_exit("Error at `video_capture.open()`\n");
+  capture_format = FRAME_FORMAT_BGR;
+  if (OPENCV_CAPTURE_NATIVE_YUYV && request_native_yuyv_frames())
+    capture_format = FRAME_FORMAT_YUYV;
+
+  // Probe the camera's frame format, and size the frame arena for it.
+  cv::Mat probe_frame_buffer;
+  while (!video_capture.read(probe_frame_buffer))
+  {
+    std::cout << "No frame.\n";
+    cv::waitKey(25);
+  }
+  if (capture_format == FRAME_FORMAT_BGR)
+    initialize_frame_arena(
+        frame_pipeline,
+        probe_frame_buffer.rows,
+        probe_frame_buffer.cols,
+        probe_frame_buffer.type());
+  else
+    initialize_frame_arena(
+        frame_pipeline,
+        (int)video_capture.get(CV_CAP_PROP_FRAME_HEIGHT),
+        (int)video_capture.get(CV_CAP_PROP_FRAME_WIDTH),
+        CV_8UC2);
+  write_log("OpenCV Capture: Format: %s", capture_format == FRAME_FORMAT_BGR ? "BGR" : "YUYV");
+
+  // Warm up each frame buffer.
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+  {
+    Frame *frame = &frame_pipeline->frames[index];
+    frame->format = capture_format;
+    while (!read_camera_frame(frame->frame_buffer))
+    {
+      std::cout << "No frame.\n";
+      cv::waitKey(25);
+    }
+  }
+}
+
+/**
+ * @brief Shuts down the camera.
+ */
+void opencv_capture_teardown(FramePipeline *frame_pipeline)
+{
+  video_capture.release();
+}
+
+/**
+ * @brief Copies the camera's next frame into the given frame's buffer.
+ * Returns `TRUE` if a frame was captured.
+ */
+int opencv_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index)
+{
+  if (!read_camera_frame(frame->frame_buffer))
+    return FALSE;
+
+  // OpenCV reallocates the buffer if the camera's format changes, which the
+  // frame arena cannot accommodate.
+  if (!is_frame_in_arena(frame_pipeline, frame))
+    print_error_and_exit("Camera frame format changed during capture\n");
+
+  return TRUE;
+}
@@ -0,0 +1,12 @@
+#ifndef OPENCV_CAPTURE_H
+#define OPENCV_CAPTURE_H
+
+#include "../sequencer.hpp"
+
+#define OPENCV_CAPTURE_NATIVE_YUYV FALSE
+
+void opencv_capture_setup(FramePipeline *frame_pipeline);
+void opencv_capture_teardown(FramePipeline *frame_pipeline);
+int opencv_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index);
+
+#endif
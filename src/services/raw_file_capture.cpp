@@ -0,0 +1,92 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <fcntl.h>
+#include <opencv2/core.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../frame_arena.hpp"
+#include "../sequencer.hpp"
+#include "../utils/error.h"
+#include "../utils/log.h"
+#include "raw_file_capture.h"
+
+unsigned char *raw_file_memory;
+size_t raw_file_size;
+size_t raw_frame_size;
+unsigned long long raw_frame_count;
+
+/**
+ * @brief Get the OpenCV type of a raw frame in the given format.
+ */
+int get_raw_frame_type(FrameFormat format)
+{
+  switch (format)
+  {
+  case FRAME_FORMAT_BGR:
+    return CV_8UC3;
+  case FRAME_FORMAT_YUYV:
+    return CV_8UC2;
+  case FRAME_FORMAT_GREY:
+    return CV_8UC1;
+  }
+  return CV_8UC1;
+}
+
+/**
+ * @brief Maps the raw frame file into memory, and lays out luma buffers in the
+ * frame arena. The file holds back-to-back frames of `RAW_FRAME_WIDTH` by
+ * `RAW_FRAME_HEIGHT` pixels in `RAW_FRAME_FORMAT`, with no headers or padding.
+ */
+void raw_file_capture_setup(FramePipeline *frame_pipeline)
+{
+  int file_descriptor = open(RAW_FILE_NAME, O_RDONLY);
+  if (file_descriptor == -1)
+    print_with_errno_and_exit("open() %s", RAW_FILE_NAME);
+
+  struct stat file_status;
+  attempt(fstat(file_descriptor, &file_status), "fstat() %s", RAW_FILE_NAME);
+  raw_file_size = file_status.st_size;
+  raw_frame_size = (size_t)RAW_FRAME_WIDTH * RAW_FRAME_HEIGHT * CV_ELEM_SIZE(get_raw_frame_type(RAW_FRAME_FORMAT));
+  raw_frame_count = raw_file_size / raw_frame_size;
+  if (raw_frame_count == 0)
+    print_error_and_exit("%s holds no complete frames\n", RAW_FILE_NAME);
+
+  // Map and prefault the whole file.
+  raw_file_memory = (unsigned char *)mmap(NULL, raw_file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file_descriptor, 0);
+  if (raw_file_memory == MAP_FAILED)
+    print_with_errno_and_exit("mmap() %s", RAW_FILE_NAME);
+  attempt(close(file_descriptor), "close() %s", RAW_FILE_NAME);
+
+  initialize_frame_arena(frame_pipeline, RAW_FRAME_HEIGHT, RAW_FRAME_WIDTH, FRAME_ARENA_NO_COLOR_BUFFERS);
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+    frame_pipeline->frames[index].format = RAW_FRAME_FORMAT;
+
+  write_log("Raw File Capture: %llu frames from %s", raw_frame_count, RAW_FILE_NAME);
+}
+
+/**
+ * @brief Does nothing. The file stays mapped until the process exits, since
+ * other stages may still be holding frames that point into it.
+ */
+void raw_file_capture_teardown(FramePipeline *frame_pipeline)
+{
+}
+
+/**
+ * @brief Points the given frame at the raw frame with the given source frame
+ * index, without copying, looping back to the first frame after the last.
+ * Always returns `TRUE`.
+ */
+int raw_file_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index)
+{
+  // The stages never write to the frame buffer, so it may wrap read-only memory.
+  unsigned char *raw_frame = raw_file_memory + (frame_index % raw_frame_count) * raw_frame_size;
+  frame->frame_buffer = cv::Mat(RAW_FRAME_HEIGHT, RAW_FRAME_WIDTH, get_raw_frame_type(RAW_FRAME_FORMAT), raw_frame);
+  return TRUE;
+}
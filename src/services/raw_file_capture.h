@@ -0,0 +1,16 @@
+#ifndef RAW_FILE_CAPTURE_H
+#define RAW_FILE_CAPTURE_H
+
+#include "../sequencer.hpp"
+
+#define RAW_FILE_NAME "frames.raw"
+#define RAW_FRAME_WIDTH (640)
+#define RAW_FRAME_HEIGHT (480)
+#define RAW_FRAME_FORMAT (FRAME_FORMAT_YUYV)
+#define RAW_FRAMES_PER_SECOND (30.0)
+
+void raw_file_capture_setup(FramePipeline *frame_pipeline);
+void raw_file_capture_teardown(FramePipeline *frame_pipeline);
+int raw_file_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index);
+
+#endif
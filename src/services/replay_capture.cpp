@@ -0,0 +1,83 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <string>
+#include <vector>
+#include "../frame_arena.hpp"
+#include "../sequencer.hpp"
+#include "../utils/error.h"
+#include "../utils/log.h"
+#include "replay_capture.h"
+
+std::vector<cv::Mat> replay_frame_buffers;
+
+/**
+ * @brief Loads every PPM and PGM image in the replay directory, in filename
+ * order, and lays out frame buffers in the frame arena to match them. The
+ * images are held in memory so that replay measures the pipeline rather than
+ * the disk.
+ */
+void replay_capture_setup(FramePipeline *frame_pipeline)
+{
+  // Find the images.
+  std::vector<std::string> filenames;
+  for (const auto &entry : std::filesystem::directory_iterator(REPLAY_DIRECTORY))
+  {
+    std::string extension = entry.path().extension().string();
+    if (extension == ".ppm" || extension == ".pgm")
+      filenames.push_back(entry.path().string());
+  }
+  std::sort(filenames.begin(), filenames.end());
+  if (filenames.empty())
+    print_error_and_exit("No PPM or PGM images in %s\n", REPLAY_DIRECTORY);
+
+  // Load the images, which must all share a format.
+  for (const std::string &filename : filenames)
+  {
+    cv::Mat image = cv::imread(filename, cv::IMREAD_UNCHANGED);
+    if (image.empty())
+      print_error_and_exit("Error reading %s\n", filename.c_str());
+    if (image.type() != CV_8UC3 && image.type() != CV_8UC1)
+      print_error_and_exit("%s is not an 8-bit color or grayscale image\n", filename.c_str());
+    if (!replay_frame_buffers.empty() &&
+        (image.rows != replay_frame_buffers[0].rows ||
+         image.cols != replay_frame_buffers[0].cols ||
+         image.type() != replay_frame_buffers[0].type()))
+      print_error_and_exit("%s does not match the format of the other images\n", filename.c_str());
+    replay_frame_buffers.push_back(image);
+  }
+
+  cv::Mat *first_frame_buffer = &replay_frame_buffers[0];
+  initialize_frame_arena(frame_pipeline, first_frame_buffer->rows, first_frame_buffer->cols, first_frame_buffer->type());
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+    frame_pipeline->frames[index].format = first_frame_buffer->type() == CV_8UC3 ? FRAME_FORMAT_BGR : FRAME_FORMAT_GREY;
+
+  write_log("Replay Capture: %zu images from %s", replay_frame_buffers.size(), REPLAY_DIRECTORY);
+}
+
+/**
+ * @brief Releases the loaded images.
+ */
+void replay_capture_teardown(FramePipeline *frame_pipeline)
+{
+  replay_frame_buffers.clear();
+}
+
+/**
+ * @brief Copies the image at the given source frame index into the given
+ * frame, looping back to the first image after the last. Always returns
+ * `TRUE`.
+ */
+int replay_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index)
+{
+  replay_frame_buffers[frame_index % replay_frame_buffers.size()].copyTo(frame->frame_buffer);
+  return TRUE;
+}
@@ -0,0 +1,13 @@
+#ifndef REPLAY_CAPTURE_H
+#define REPLAY_CAPTURE_H
+
+#include "../sequencer.hpp"
+
+#define REPLAY_DIRECTORY "replay"
+#define REPLAY_FRAMES_PER_SECOND (30.0)
+
+void replay_capture_setup(FramePipeline *frame_pipeline);
+void replay_capture_teardown(FramePipeline *frame_pipeline);
+int replay_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index);
+
+#endif
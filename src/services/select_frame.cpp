@@ -5,34 +5,436 @@
  * @date 2022
  */
 
-#include <mqueue.h>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include "../frame_queue.hpp"
 #include "../sequencer.hpp"
+#include "../sharpness.hpp"
+#include "../tick_tracker.hpp"
 #include "../utils/error.h"
 #include "../utils/log.h"
 #include "../utils/time.h"
 #include "select_frame.h"
 
-#define TICK_DETECTION_THRESHOLD_PERCENTAGE (0.45)
+#define SCORE_SHARPNESS TRUE
+#define SHARPNESS_MEASURE SHARPNESS_MEASURE_LAPLACIAN_VARIANCE
+#define SHARPNESS_DIFFERENCE_WEIGHT (4.0)
+#define SHARPNESS_CEILING_MARGIN (0.1)
+#define MAXIMUM_SHARPNESS_SCORES_PER_TICK (8)
+#define RETROACTIVE_SELECTION TRUE
+#define INTERPOLATE_TICK_TIME TRUE
+#define HISTORY_SECONDS (2.0)
+#define MAXIMUM_HISTORY_FRAMES (48)
+#define ADAPTIVE_TICK_THRESHOLD TRUE
+#define TICK_THRESHOLD_WINDOW (256)
+#define TICK_THRESHOLD_UPDATE_PERIOD (32)
+#define TICK_THRESHOLD_NOISE_DEVIATIONS (8.0)
+#define TICK_THRESHOLD_HYSTERESIS (0.6)
+#define TICK_THRESHOLD_DRIFT_RATIO (0.2)
+#define TICK_LEVEL_SMOOTHING (0.25)
+#define MINIMUM_TICK_THRESHOLD_PERCENTAGE (0.02)
+#define MAXIMUM_TICK_THRESHOLD_PERCENTAGE (10.0)
+#define FRAMES_HELD_OUTSIDE_HISTORY (16)
+
+// Capture blocks until a frame is released, and the history only lets frames
+// go as new ones arrive, so the history must leave frames for every other
+// holder: one in each stage, Difference Frame's previous frame, the current
+// best frame, and the frames waiting to be written.
+static_assert(
+    MAXIMUM_HISTORY_FRAMES + FRAMES_HELD_OUTSIDE_HISTORY < NUMBER_OF_FRAMES,
+    "The frame history would leave too few frames for the rest of the pipeline");
+
+/**
+ * @brief The most recent frames, oldest first, each held by a reference so
+ * that it can still be selected once later frames have arrived.
+ */
+typedef struct FrameHistory
+{
+  Frame *frames[MAXIMUM_HISTORY_FRAMES];
+  int head;
+  int count;
+} FrameHistory;
 
 double previous_difference_percentage{0};
+int is_ticking;
 Frame *current_best_frame;
+double current_best_score;
+
+FrameHistory frame_history;
+double interval_start_time;
+unsigned long long backfilled_tick_count;
+unsigned long long dropped_selected_frame_count;
+
+double maximum_sharpness, previous_maximum_sharpness;
+unsigned int sharpness_score_count;
+unsigned long long total_sharpness_score_count, skipped_sharpness_score_count;
+
+double difference_percentage_window[TICK_THRESHOLD_WINDOW];
+double sorted_difference_percentages[TICK_THRESHOLD_WINDOW];
+unsigned long long difference_percentage_count;
+double tick_peak_percentage, tick_level_percentage;
+double noise_floor_percentage;
+
+double previous_frame_time;
+double tick_curve_origin_time, tick_curve_weight, tick_curve_weighted_time, tick_frame_interval;
+double logged_rising_threshold_percentage;
 
 unsigned int frame_count;
 
+/**
+ * @brief Replace the current best frame with the given frame and its score,
+ * holding a reference to it for as long as it remains the best.
+ */
+void set_current_best_frame(FramePipeline *frame_pipeline, Frame *frame, double score)
+{
+  retain_frame(frame);
+  if (current_best_frame != NULL)
+    release_frame(frame_pipeline, current_best_frame);
+  current_best_frame = frame;
+  current_best_score = score;
+}
+
+/**
+ * @brief Enqueue a selected frame for writing, with a reference for the
+ * writer. While the writer reports that it has no room for more writes, the
+ * frame is dropped instead, so that selected frames do not pile up waiting.
+ */
+void enqueue_selected_frame(FramePipeline *frame_pipeline, Frame *frame)
+{
+  if (frame_pipeline->is_write_backpressured.load())
+  {
+    write_log_with_timer("Select Frame - WRITER BACKPRESSURED, DROPPING SELECTED FRAME");
+    ++dropped_selected_frame_count;
+    return;
+  }
+
+  retain_frame(frame);
+  enqueue_frame(&frame_pipeline->selected_frame_queue, frame);
+}
+
+/**
+ * @brief Begin a new search for the best frame since the given time, starting
+ * with the given frame. It is left unscored, so that any sharp stable frame
+ * replaces it.
+ */
+void begin_best_frame_search(FramePipeline *frame_pipeline, Frame *frame, double start_time)
+{
+  set_current_best_frame(frame_pipeline, frame, -1);
+  previous_maximum_sharpness = maximum_sharpness;
+  maximum_sharpness = 0;
+  sharpness_score_count = 0;
+  interval_start_time = start_time;
+}
+
+/**
+ * @brief Get the frame at the given index of the history, counting from the
+ * oldest.
+ */
+Frame *get_history_frame(int index)
+{
+  return frame_history.frames[(frame_history.head + index) % MAXIMUM_HISTORY_FRAMES];
+}
+
+/**
+ * @brief Release the oldest frame in the history.
+ */
+void drop_oldest_history_frame(FramePipeline *frame_pipeline)
+{
+  release_frame(frame_pipeline, get_history_frame(0));
+  frame_history.head = (frame_history.head + 1) % MAXIMUM_HISTORY_FRAMES;
+  --frame_history.count;
+}
+
+/**
+ * @brief Add a frame to the history, holding a reference to it, and drop the
+ * frames captured too long before it, or the oldest frame when the history is
+ * full.
+ */
+void push_history_frame(FramePipeline *frame_pipeline, Frame *frame)
+{
+  double time = get_time_in_seconds(&frame->capture_time);
+  while (frame_history.count > 0 &&
+         (frame_history.count == MAXIMUM_HISTORY_FRAMES ||
+          time - get_time_in_seconds(&get_history_frame(0)->capture_time) > HISTORY_SECONDS))
+    drop_oldest_history_frame(frame_pipeline);
+
+  retain_frame(frame);
+  frame_history.frames[(frame_history.head + frame_history.count) % MAXIMUM_HISTORY_FRAMES] = frame;
+  ++frame_history.count;
+}
+
+/**
+ * @brief Get a frame's sharpness, measuring it only the first time.
+ */
+double get_frame_sharpness(Frame *frame)
+{
+  if (frame->sharpness < 0)
+  {
+    frame->sharpness = measure_frame_sharpness(frame, SHARPNESS_MEASURE);
+    ++total_sharpness_score_count;
+    write_log_with_timer("Select Frame - Sharpness: %f", frame->sharpness);
+  }
+  return frame->sharpness;
+}
+
+/**
+ * @brief Compare two frames' differences for sorting from least to most
+ * different.
+ */
+int compare_frame_differences(const void *a, const void *b)
+{
+  const Frame *frame_a = *(Frame *const *)a;
+  const Frame *frame_b = *(Frame *const *)b;
+  return (frame_a->difference_percentage > frame_b->difference_percentage) -
+         (frame_a->difference_percentage < frame_b->difference_percentage);
+}
+
+/**
+ * @brief Combine a frame's sharpness with its difference from the previous
+ * frame into a score, where higher is better. Motion since the previous frame
+ * discounts the sharpness, reaching a fifth of it at the rising tick
+ * threshold.
+ */
+double get_frame_score(FramePipeline *frame_pipeline, Frame *frame, double sharpness)
+{
+  double rising_threshold_percentage = frame_pipeline->tick_threshold.rising_percentage.load(std::memory_order_relaxed);
+  return sharpness / (1.0 + SHARPNESS_DIFFERENCE_WEIGHT * frame->difference_percentage / rising_threshold_percentage);
+}
+
+/**
+ * @brief Get the median of the first given number of sorted difference
+ * percentages, reordering them.
+ */
+double get_median_difference_percentage(int count)
+{
+  std::nth_element(sorted_difference_percentages, sorted_difference_percentages + count / 2, sorted_difference_percentages + count);
+  return sorted_difference_percentages[count / 2];
+}
+
+/**
+ * @brief Add a frame's difference to the running distribution, and
+ * periodically recalibrate the tick thresholds from it.
+ *
+ * Most frames are stable, so the median and the median absolute deviation of
+ * the recent differences measure the noise floor, and are barely moved by the
+ * few frames that tick. The rising threshold sits well above the noise, but
+ * no more than halfway to the typical peak of a tick, so that faint ticks are
+ * still caught. The falling threshold sits a fraction of the way from the
+ * noise floor to the rising threshold, for hysteresis.
+ */
+void update_tick_threshold(FramePipeline *frame_pipeline, Frame *frame)
+{
+  difference_percentage_window[difference_percentage_count % TICK_THRESHOLD_WINDOW] = frame->difference_percentage;
+  ++difference_percentage_count;
+  if (!ADAPTIVE_TICK_THRESHOLD ||
+      difference_percentage_count < TICK_THRESHOLD_WINDOW ||
+      difference_percentage_count % TICK_THRESHOLD_UPDATE_PERIOD != 0)
+    return;
+
+  // Find the noise floor and spread, scaling the median absolute deviation to
+  // a standard deviation.
+  std::copy(difference_percentage_window, difference_percentage_window + TICK_THRESHOLD_WINDOW, sorted_difference_percentages);
+  double median = get_median_difference_percentage(TICK_THRESHOLD_WINDOW);
+  noise_floor_percentage = median;
+  for (int index = 0; index < TICK_THRESHOLD_WINDOW; ++index)
+    sorted_difference_percentages[index] = fabs(difference_percentage_window[index] - median);
+  double deviation = 1.4826 * get_median_difference_percentage(TICK_THRESHOLD_WINDOW);
+
+  // Place the thresholds between the noise and the ticks.
+  double rising_threshold_percentage = median + TICK_THRESHOLD_NOISE_DEVIATIONS * deviation;
+  if (tick_level_percentage > median)
+    rising_threshold_percentage = fmin(rising_threshold_percentage, (median + tick_level_percentage) / 2.0);
+  rising_threshold_percentage = fmin(fmax(rising_threshold_percentage, MINIMUM_TICK_THRESHOLD_PERCENTAGE), MAXIMUM_TICK_THRESHOLD_PERCENTAGE);
+  double falling_threshold_percentage = fmin(median + TICK_THRESHOLD_HYSTERESIS * (rising_threshold_percentage - median), rising_threshold_percentage);
+  frame_pipeline->tick_threshold.rising_percentage.store(rising_threshold_percentage, std::memory_order_relaxed);
+  frame_pipeline->tick_threshold.falling_percentage.store(falling_threshold_percentage, std::memory_order_relaxed);
+
+  if (logged_rising_threshold_percentage == 0 ||
+      fabs(rising_threshold_percentage - logged_rising_threshold_percentage) > TICK_THRESHOLD_DRIFT_RATIO * logged_rising_threshold_percentage)
+  {
+    write_log_with_timer(
+        "Select Frame - TICK THRESHOLD DRIFTED, Rising: %f, Falling: %f, Median: %f, Deviation: %f, Tick Level: %f",
+        rising_threshold_percentage,
+        falling_threshold_percentage,
+        median,
+        deviation,
+        tick_level_percentage);
+    logged_rising_threshold_percentage = rising_threshold_percentage;
+  }
+}
+
+/**
+ * @brief Add a frame to the difference curve of the current tick, weighted by
+ * its difference above the noise floor.
+ */
+void add_tick_curve_point(double time, double difference_percentage)
+{
+  double weight = fmax(difference_percentage - noise_floor_percentage, 0.0);
+  tick_curve_weight += weight;
+  tick_curve_weighted_time += weight * (time - tick_curve_origin_time);
+}
+
+/**
+ * @brief Start the difference curve of a tick first detected in the frame at
+ * the given time, from the frame before it.
+ *
+ * The curve includes the frame before the tick was detected, since a tick
+ * during that frame's exposure raises its difference without crossing the
+ * threshold.
+ */
+void begin_tick_curve(double time, double difference_percentage)
+{
+  tick_frame_interval = previous_frame_time > 0 ? time - previous_frame_time : 0;
+  tick_curve_origin_time = time;
+  tick_curve_weight = 0;
+  tick_curve_weighted_time = 0;
+  if (previous_frame_time > 0)
+    add_tick_curve_point(previous_frame_time, previous_difference_percentage);
+  add_tick_curve_point(time, difference_percentage);
+}
+
+/**
+ * @brief Estimate the instant of the tick from its difference curve.
+ *
+ * Each frame's difference measures the change during the interval before it,
+ * so a tick inside one frame's interval raises only that frame's difference,
+ * and a tick straddling two frames' exposures splits between them in
+ * proportion. Interpolating, the tick happened half a frame interval before
+ * the centroid of the curve. Without a curve above the noise floor, the tick
+ * is taken to be halfway between the frames it was detected between.
+ */
+double get_tick_curve_time()
+{
+  if (tick_curve_weight <= 0)
+    return tick_curve_origin_time - tick_frame_interval / 2;
+  return tick_curve_origin_time + tick_curve_weighted_time / tick_curve_weight - tick_frame_interval / 2;
+}
+
+/**
+ * @brief Decide whether a frame should replace the current best frame, and
+ * get its score if it was scored. An unscored frame's score is negative.
+ *
+ * Without sharpness scoring, the frame with the least difference from its
+ * previous frame is best. With it, a frame is only scored when it could win
+ * while no sharper than the sharpest frame of the last two ticks, allowing a
+ * margin, and only so many frames are scored between ticks.
+ *
+ * With retroactive selection the history makes the final choice, so the
+ * current best frame is only a fallback, chosen by difference alone.
+ */
+int is_better_frame(FramePipeline *frame_pipeline, Frame *frame, double *score)
+{
+  *score = -1;
+  if (current_best_frame == NULL)
+    return TRUE;
+
+  // Frames predicted to be near a tick never compete.
+  if (frame->tick_window != TICK_WINDOW_UNLOCKED && frame->tick_window != TICK_WINDOW_STABLE)
+    return FALSE;
+
+  if (!SCORE_SHARPNESS || RETROACTIVE_SELECTION)
+    return frame->difference_percentage < current_best_frame->difference_percentage;
+
+  // Skip scoring frames that cannot win.
+  double sharpness_ceiling = fmax(maximum_sharpness, previous_maximum_sharpness) * (1.0 + SHARPNESS_CEILING_MARGIN);
+  if (sharpness_score_count >= MAXIMUM_SHARPNESS_SCORES_PER_TICK ||
+      (sharpness_ceiling > 0 && get_frame_score(frame_pipeline, frame, sharpness_ceiling) <= current_best_score))
+  {
+    ++skipped_sharpness_score_count;
+    return FALSE;
+  }
+
+  double sharpness = get_frame_sharpness(frame);
+  ++sharpness_score_count;
+  maximum_sharpness = fmax(maximum_sharpness, sharpness);
+  *score = get_frame_score(frame_pipeline, frame, sharpness);
+  write_log_with_timer("Select Frame - Score: %f", *score);
+  return *score > current_best_score;
+}
+
+/**
+ * @brief Choose the best frame in the history captured from the start time up
+ * to the end time, with full knowledge of the frames between. Returns NULL
+ * when the history holds no candidates from that time.
+ *
+ * As when choosing causally, frames predicted to be near a tick never compete.
+ * The candidates are scored from least to most different, so once even a
+ * frame as sharp as the sharpest scored so far, allowing a margin, could not
+ * win, none of the rest can either.
+ */
+Frame *select_frame_from_history(FramePipeline *frame_pipeline, double start_time, double end_time)
+{
+  Frame *candidates[MAXIMUM_HISTORY_FRAMES];
+  int candidate_count = 0;
+  for (int index = 0; index < frame_history.count; ++index)
+  {
+    Frame *frame = get_history_frame(index);
+    double time = get_time_in_seconds(&frame->capture_time);
+    if (time >= start_time && time < end_time &&
+        (frame->tick_window == TICK_WINDOW_UNLOCKED || frame->tick_window == TICK_WINDOW_STABLE))
+      candidates[candidate_count++] = frame;
+  }
+  if (candidate_count == 0)
+    return NULL;
+
+  qsort(candidates, candidate_count, sizeof(Frame *), compare_frame_differences);
+  if (!SCORE_SHARPNESS)
+    return candidates[0];
+
+  Frame *best_frame = candidates[0];
+  double best_score = -1, sharpness_ceiling = 0;
+  int index = 0;
+  for (; index < candidate_count && index < MAXIMUM_SHARPNESS_SCORES_PER_TICK; ++index)
+  {
+    if (sharpness_ceiling > 0 && get_frame_score(frame_pipeline, candidates[index], sharpness_ceiling) <= best_score)
+      break;
+    double sharpness = get_frame_sharpness(candidates[index]);
+    sharpness_ceiling = fmax(sharpness_ceiling, sharpness * (1.0 + SHARPNESS_CEILING_MARGIN));
+    double score = get_frame_score(frame_pipeline, candidates[index], sharpness);
+    if (score > best_score)
+    {
+      best_frame = candidates[index];
+      best_score = score;
+    }
+  }
+  skipped_sharpness_score_count += candidate_count - index;
+
+  write_log_with_timer("Select Frame - History Candidates: %i, Scored: %i, Best Score: %f", candidate_count, index, best_score);
+  return best_frame;
+}
+
 /**
  * @brief Initializes values used by the selection algorithm.
  */
 void select_frame_setup(FramePipeline *frame_pipeline)
 {
-  // Initialize the current best frame.
-  current_best_frame = &frame_pipeline->frames[0];
+  // There is no best frame until the first frame arrives.
+  current_best_frame = NULL;
 }
 
 /**
- * @brief Does nothing.
+ * @brief Releases the current best frame and the history, and reports how
+ * often scoring a frame's sharpness was skipped, how many ticks were
+ * backfilled, and how many selected frames were dropped under backpressure.
  */
 void select_frame_teardown(FramePipeline *frame_pipeline)
 {
+  if (current_best_frame != NULL)
+    release_frame(frame_pipeline, current_best_frame);
+  while (frame_history.count > 0)
+    drop_oldest_history_frame(frame_pipeline);
+
+  if (RETROACTIVE_SELECTION)
+    write_log("Select Frame - Backfilled Ticks: %llu", backfilled_tick_count);
+
+  write_log("Select Frame - Dropped Selected Frames: %llu", dropped_selected_frame_count);
+
+  if (SCORE_SHARPNESS)
+    write_log(
+        "Select Frame - Sharpness Scored: %llu, Skipped: %llu",
+        total_sharpness_score_count,
+        skipped_sharpness_score_count);
 }
 
 /**
@@ -40,21 +442,32 @@ void select_frame_teardown(FramePipeline *frame_pipeline)
  * reference to the most stable frame since the most recent tick event.
  *
  * When a tick event is detected, determined by the relative difference from
- * the previous frame crossing above a certain threshold, the stable frame is
+ * the previous frame crossing above the rising threshold, the stable frame is
  * added to the que for writing to disk. The stable is reset the next time the
- * relative difference falls back below the threshold.
+ * relative difference falls back below the falling threshold. When indicated,
+ * both thresholds calibrate themselves from the recent differences.
+ *
+ * Each tick detected also steers the tick tracker. While it is locked, only
+ * frames in the predicted stable window compete to be the best frame.
+ *
+ * When indicated, frames also compete on their sharpness, which is only
+ * measured for frames that might win.
+ *
+ * With retroactive selection, the last few seconds of frames are held in a
+ * history, and the frame written for each tick is chosen from the history
+ * once the tick is detected, falling back to the causal best frame when the
+ * history does not reach back far enough. A tick the tracker predicted but
+ * that was too faint to detect is backfilled from the history.
+ *
+ * The tick tracker is steered by the time of each tick. When indicated, the
+ * time is interpolated between frames from the difference curve once the
+ * tick is over, rather than taken halfway between the frames it was detected
+ * between.
  */
 void select_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter)
 {
   // Dequeue the next differenced frame.
-  Frame *frame;
-  attempt(
-      mq_receive(
-          frame_pipeline->difference_frame_queue,
-          (char *)&frame,
-          sizeof(Frame *),
-          NULL),
-      "mq_receive() difference_frame_queue in select_frame");
+  Frame *frame = dequeue_frame(&frame_pipeline->difference_frame_queue);
 
   // Start request timer.
   write_log_with_timer("Service: %i, Service Name: %s, Request: %u, BEGIN", service->id, service->name, request_counter);
@@ -62,36 +475,94 @@ void select_frame(FramePipeline *frame_pipeline, Service *service, unsigned int
 
   write_log_with_timer("Select Frame - Previous: %f, Current: %f", previous_difference_percentage, frame->difference_percentage);
 
+  // Hold the frame in the history, unscored.
+  frame->sharpness = -1;
+  push_history_frame(frame_pipeline, frame);
+
+  // Follow the clock's ticks.
+  int is_tick =
+      !is_ticking &&
+      frame->difference_percentage >= frame_pipeline->tick_threshold.rising_percentage.load(std::memory_order_relaxed);
+  int is_stable =
+      is_ticking &&
+      frame->difference_percentage < frame_pipeline->tick_threshold.falling_percentage.load(std::memory_order_relaxed);
+  // Time the tick, once it is over when interpolating.
+  double time = get_time_in_seconds(&frame->capture_time);
+  double tick_time = 0;
+  if (is_tick && INTERPOLATE_TICK_TIME)
+    begin_tick_curve(time, frame->difference_percentage);
+  else if (is_tick)
+    tick_time = previous_frame_time > 0 ? (previous_frame_time + time) / 2 : time;
+  else if (is_ticking && INTERPOLATE_TICK_TIME)
+  {
+    add_tick_curve_point(time, frame->difference_percentage);
+    if (is_stable)
+    {
+      tick_time = get_tick_curve_time();
+      write_log_with_timer("Select Frame - Interpolated Tick Time: %f", tick_time);
+    }
+  }
+
+  double missed_tick_time;
+  int is_tick_missed = update_tick_tracker(
+      &frame_pipeline->tick_tracker,
+      &frame->capture_time,
+      is_ticking || is_tick,
+      tick_time,
+      &missed_tick_time);
+  update_tick_threshold(frame_pipeline, frame);
+
+  double score;
+
   if (
       // This frame crosses above the threshold.
-      previous_difference_percentage < TICK_DETECTION_THRESHOLD_PERCENTAGE &&
-      frame->difference_percentage >= TICK_DETECTION_THRESHOLD_PERCENTAGE)
+      current_best_frame != NULL &&
+      is_tick)
   {
     write_log_with_timer("Select Frame - TICK DETECTED, SAVING BEST FRAME", previous_difference_percentage, frame->difference_percentage);
-    // Enqueue the selected frame buffer.
-    attempt(
-        mq_send(
-            frame_pipeline->selected_frame_queue,
-            (const char *)&current_best_frame,
-            sizeof(Frame *),
-            0),
-        "mq_send() selected_frame_queue in select_frame");
+    Frame *selected_frame = current_best_frame;
+    if (RETROACTIVE_SELECTION)
+    {
+      Frame *history_frame = select_frame_from_history(frame_pipeline, interval_start_time, time);
+      if (history_frame != NULL)
+        selected_frame = history_frame;
+    }
+
+    // Enqueue the selected frame buffer for the writer.
+    enqueue_selected_frame(frame_pipeline, selected_frame);
   }
   else if (
       // This frame crosses below the threshold.
-      previous_difference_percentage >= TICK_DETECTION_THRESHOLD_PERCENTAGE &&
-      frame->difference_percentage < TICK_DETECTION_THRESHOLD_PERCENTAGE)
+      is_stable)
   {
     write_log_with_timer("Select Frame - STABILITY DETECTED, RESETTING BEST FRAME", previous_difference_percentage, frame->difference_percentage);
 
     // Begin a new search for the best frame, staring with this one.
-    current_best_frame = frame;
+    begin_best_frame_search(frame_pipeline, frame, time);
+  }
+  else if (
+      // A tick was predicted but not detected.
+      RETROACTIVE_SELECTION &&
+      !is_ticking &&
+      is_tick_missed)
+  {
+    // Backfill the tick from the history, as if it had been detected.
+    Frame *history_frame = select_frame_from_history(frame_pipeline, interval_start_time, missed_tick_time);
+    if (history_frame != NULL)
+    {
+      write_log_with_timer("Select Frame - TICK MISSED, BACKFILLING FROM HISTORY");
+      enqueue_selected_frame(frame_pipeline, history_frame);
+      ++backfilled_tick_count;
+    }
+
+    // Begin a new search for the best frame after the missed tick.
+    begin_best_frame_search(frame_pipeline, frame, missed_tick_time);
   }
   else if (
       // This frame is better than the current best frame.
-      frame->difference_percentage < current_best_frame->difference_percentage)
+      is_better_frame(frame_pipeline, frame, &score))
     // Make this frame the new best frame.
-    current_best_frame = frame;
+    set_current_best_frame(frame_pipeline, frame, score);
 
   // End request timer.
   get_current_monotonic_raw_time(&service->work_complete_time);
@@ -102,15 +573,30 @@ void select_frame(FramePipeline *frame_pipeline, Service *service, unsigned int
       request_counter,
       get_elapsed_time_in_seconds(&service->work_start_time, &service->work_complete_time));
 
-  // Enqueue the processed frame.
-  attempt(
-      mq_send(
-          frame_pipeline->available_frame_queue,
-          (const char *)&frame,
-          sizeof(Frame *),
-          0),
-      "mq_send() available_frame_queue in select_frame");
+  // Follow the typical peak difference of a tick. A difference cut short at
+  // the rising threshold only bounds the peak from below, so it is left out,
+  // and a tick with no complete measurement leaves the level as it is.
+  if (is_tick)
+  {
+    is_ticking = TRUE;
+    tick_peak_percentage = 0;
+  }
+  else if (is_stable)
+  {
+    is_ticking = FALSE;
+    if (tick_peak_percentage > 0 && tick_level_percentage == 0)
+      tick_level_percentage = tick_peak_percentage;
+    else if (tick_peak_percentage > 0)
+      tick_level_percentage += TICK_LEVEL_SMOOTHING * (tick_peak_percentage - tick_level_percentage);
+  }
+  if (is_ticking && !frame->is_difference_lower_bound)
+    tick_peak_percentage = fmax(tick_peak_percentage, frame->difference_percentage);
 
   previous_difference_percentage = frame->difference_percentage;
+  previous_frame_time = time;
   ++frame_count;
+
+  // Release the pipeline's reference to the processed frame, only once nothing
+  // more is read from it.
+  release_frame(frame_pipeline, frame);
 }
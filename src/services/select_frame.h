@@ -3,6 +3,8 @@
 
 #include "../sequencer.hpp"
 
+#define TICK_DETECTION_THRESHOLD_PERCENTAGE (0.45)
+
 void select_frame_setup(FramePipeline *frame_pipeline);
 void select_frame_teardown(FramePipeline *frame_pipeline);
 void select_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter);
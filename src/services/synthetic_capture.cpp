@@ -0,0 +1,113 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "../frame_arena.hpp"
+#include "../sequencer.hpp"
+#include "synthetic_capture.h"
+
+#define TICKS_PER_REVOLUTION (60)
+
+/**
+ * @brief Draw a clock hand from the center of the face, pointing at the given
+ * fraction of a revolution clockwise from twelve o'clock.
+ */
+void draw_clock_hand(cv::Mat *frame_buffer, cv::Point center, double revolution, int length, int thickness)
+{
+  double angle = revolution * 2 * M_PI;
+  cv::Point tip(
+      center.x + (int)lround(length * sin(angle)),
+      center.y - (int)lround(length * cos(angle)));
+  cv::line(*frame_buffer, center, tip, cv::Scalar(0, 0, 0), thickness, cv::LINE_AA);
+}
+
+/**
+ * @brief Add deterministic uniform noise to every pixel of a frame, seeded by
+ * the frame index so the same frame always renders identically.
+ */
+void add_frame_noise(cv::Mat *frame_buffer, unsigned long long frame_index)
+{
+  if (SYNTHETIC_NOISE_AMPLITUDE <= 0)
+    return;
+
+  // A xorshift generator is cheap and has no shared state.
+  uint64_t state = (frame_index + 1) * 0x9E3779B97F4A7C15ULL;
+  for (int row = 0; row < frame_buffer->rows; ++row)
+  {
+    unsigned char *pixel = frame_buffer->ptr(row);
+    unsigned char *row_end = pixel + (size_t)frame_buffer->cols * frame_buffer->channels();
+    for (; pixel < row_end; ++pixel)
+    {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      int value = *pixel + (int)(state % (2 * SYNTHETIC_NOISE_AMPLITUDE + 1)) - SYNTHETIC_NOISE_AMPLITUDE;
+      *pixel = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+  }
+}
+
+/**
+ * @brief Lays out BGR frame buffers in the frame arena at the synthetic
+ * resolution.
+ */
+void synthetic_capture_setup(FramePipeline *frame_pipeline)
+{
+  initialize_frame_arena(frame_pipeline, SYNTHETIC_FRAME_HEIGHT, SYNTHETIC_FRAME_WIDTH, CV_8UC3);
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+    frame_pipeline->frames[index].format = FRAME_FORMAT_BGR;
+}
+
+/**
+ * @brief Does nothing.
+ */
+void synthetic_capture_teardown(FramePipeline *frame_pipeline)
+{
+}
+
+/**
+ * @brief Renders an analog clock into the given frame as it appears at the
+ * given source frame index. The second hand steps once per tick, at the
+ * pipeline's tick frequency, so frames between ticks differ only by noise.
+ * Always returns `TRUE`.
+ */
+int synthetic_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index)
+{
+  cv::Mat *frame_buffer = &frame->frame_buffer;
+  cv::Point center(frame_buffer->cols / 2, frame_buffer->rows / 2);
+  int radius = (frame_buffer->cols < frame_buffer->rows ? frame_buffer->cols : frame_buffer->rows) * 2 / 5;
+
+  // Find the current tick.
+  unsigned long long tick = (unsigned long long)(frame_index * frame_pipeline->tick_frequency / SYNTHETIC_FRAMES_PER_SECOND);
+
+  // Draw the face and its tick marks.
+  frame_buffer->setTo(cv::Scalar(200, 200, 200));
+  cv::circle(*frame_buffer, center, radius, cv::Scalar(255, 255, 255), cv::FILLED, cv::LINE_AA);
+  cv::circle(*frame_buffer, center, radius, cv::Scalar(40, 40, 40), 4, cv::LINE_AA);
+  for (int mark = 0; mark < TICKS_PER_REVOLUTION; ++mark)
+  {
+    double angle = (double)mark / TICKS_PER_REVOLUTION * 2 * M_PI;
+    int inner_radius = mark % 5 == 0 ? radius * 8 / 10 : radius * 9 / 10;
+    cv::line(
+        *frame_buffer,
+        cv::Point(center.x + (int)lround(inner_radius * sin(angle)), center.y - (int)lround(inner_radius * cos(angle))),
+        cv::Point(center.x + (int)lround(radius * sin(angle)), center.y - (int)lround(radius * cos(angle))),
+        cv::Scalar(40, 40, 40),
+        2,
+        cv::LINE_AA);
+  }
+
+  // Draw the hands.
+  draw_clock_hand(frame_buffer, center, (double)(tick % (TICKS_PER_REVOLUTION * TICKS_PER_REVOLUTION)) / (TICKS_PER_REVOLUTION * TICKS_PER_REVOLUTION), radius * 6 / 10, 6);
+  draw_clock_hand(frame_buffer, center, (double)(tick % TICKS_PER_REVOLUTION) / TICKS_PER_REVOLUTION, radius * 9 / 10, 2);
+
+  add_frame_noise(frame_buffer, frame_index);
+  return TRUE;
+}
@@ -0,0 +1,15 @@
+#ifndef SYNTHETIC_CAPTURE_H
+#define SYNTHETIC_CAPTURE_H
+
+#include "../sequencer.hpp"
+
+#define SYNTHETIC_FRAME_WIDTH (640)
+#define SYNTHETIC_FRAME_HEIGHT (480)
+#define SYNTHETIC_FRAMES_PER_SECOND (30.0)
+#define SYNTHETIC_NOISE_AMPLITUDE (4)
+
+void synthetic_capture_setup(FramePipeline *frame_pipeline);
+void synthetic_capture_teardown(FramePipeline *frame_pipeline);
+int synthetic_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index);
+
+#endif
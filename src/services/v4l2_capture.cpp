@@ -0,0 +1,299 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <opencv2/core.hpp>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../frame_arena.hpp"
+#include "../sequencer.hpp"
+#include "../utils/error.h"
+#include "../utils/log.h"
+#include "v4l2_capture.h"
+
+/**
+ * @brief A buffer shared with the camera driver.
+ */
+typedef struct DriverBuffer
+{
+  void *start;
+  size_t length;
+} DriverBuffer;
+
+int camera_file_descriptor = -1;
+int is_camera_streaming = FALSE;
+DriverBuffer driver_buffers[DRIVER_MMAP_BUFFERS];
+unsigned int driver_buffer_count;
+unsigned int held_driver_buffer_count;
+unsigned long long copied_frame_count;
+cv::Mat copy_buffers[NUMBER_OF_FRAMES];
+struct v4l2_format camera_format;
+
+/**
+ * @brief Perform an ioctl on the camera, retrying if interrupted.
+ */
+int camera_ioctl(unsigned long request, void *argument)
+{
+  int result;
+  do
+    result = ioctl(camera_file_descriptor, request, argument);
+  while (result == -1 && errno == EINTR);
+  return result;
+}
+
+/**
+ * @brief Hand a buffer back to the camera driver to be filled.
+ */
+void queue_driver_buffer(unsigned int index)
+{
+  struct v4l2_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.index = index;
+  attempt(camera_ioctl(VIDIOC_QBUF, &buffer), "VIDIOC_QBUF");
+}
+
+/**
+ * @brief Determine whether the driver has handed a buffer out, and so will
+ * not fill it again until it is queued.
+ */
+int is_driver_buffer_dequeued(unsigned int index)
+{
+  struct v4l2_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.index = index;
+  attempt(camera_ioctl(VIDIOC_QUERYBUF, &buffer), "VIDIOC_QUERYBUF");
+  return (buffer.flags & (V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE)) == 0;
+}
+
+/**
+ * @brief Open the camera and configure it to capture YUYV frames, or
+ * grayscale frames if that is all it supports.
+ */
+void open_camera()
+{
+  camera_file_descriptor = open(CAMERA_DEVICE_NAME, O_RDWR | O_NONBLOCK);
+  if (camera_file_descriptor == -1)
+    print_with_errno_and_exit("open() %s", CAMERA_DEVICE_NAME);
+
+  // Check that the camera can stream.
+  struct v4l2_capability capability;
+  attempt(camera_ioctl(VIDIOC_QUERYCAP, &capability), "VIDIOC_QUERYCAP");
+  if (!(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE))
+    print_error_and_exit("%s is not a video capture device\n", CAMERA_DEVICE_NAME);
+  if (!(capability.capabilities & V4L2_CAP_STREAMING))
+    print_error_and_exit("%s does not support streaming\n", CAMERA_DEVICE_NAME);
+
+  // Set the format. The driver may adjust the resolution.
+  memset(&camera_format, 0, sizeof(camera_format));
+  camera_format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  camera_format.fmt.pix.width = CAMERA_HORIZONTAL_RESOLUTION;
+  camera_format.fmt.pix.height = CAMERA_VERTICAL_RESOLUTION;
+  camera_format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+  camera_format.fmt.pix.field = V4L2_FIELD_NONE;
+  attempt(camera_ioctl(VIDIOC_S_FMT, &camera_format), "VIDIOC_S_FMT");
+  if (camera_format.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV && camera_format.fmt.pix.pixelformat != V4L2_PIX_FMT_GREY)
+    print_error_and_exit("%s supports neither YUYV nor GREY\n", CAMERA_DEVICE_NAME);
+}
+
+/**
+ * @brief Map the camera driver's buffers into memory, queue them all to be
+ * filled, and start streaming.
+ */
+void start_camera_streaming()
+{
+  struct v4l2_requestbuffers request;
+  memset(&request, 0, sizeof(request));
+  request.count = DRIVER_MMAP_BUFFERS;
+  request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  request.memory = V4L2_MEMORY_MMAP;
+  attempt(camera_ioctl(VIDIOC_REQBUFS, &request), "VIDIOC_REQBUFS");
+  if (request.count < 2)
+    print_error_and_exit("Insufficient buffer memory on %s\n", CAMERA_DEVICE_NAME);
+  driver_buffer_count = request.count < DRIVER_MMAP_BUFFERS ? request.count : DRIVER_MMAP_BUFFERS;
+  if (driver_buffer_count <= DRIVER_BUFFER_RESERVE)
+    print_error_and_exit(
+        "%s has %u buffers, but %u must stay queued to the driver\n",
+        CAMERA_DEVICE_NAME,
+        driver_buffer_count,
+        DRIVER_BUFFER_RESERVE);
+  held_driver_buffer_count = 0;
+
+  for (unsigned int index = 0; index < driver_buffer_count; ++index)
+  {
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = index;
+    attempt(camera_ioctl(VIDIOC_QUERYBUF, &buffer), "VIDIOC_QUERYBUF");
+
+    driver_buffers[index].length = buffer.length;
+    driver_buffers[index].start = mmap(
+        NULL,
+        buffer.length,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        camera_file_descriptor,
+        buffer.m.offset);
+    if (driver_buffers[index].start == MAP_FAILED)
+      print_with_errno_and_exit("mmap() driver buffer");
+
+    queue_driver_buffer(index);
+  }
+
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  attempt(camera_ioctl(VIDIOC_STREAMON, &type), "VIDIOC_STREAMON");
+  is_camera_streaming = TRUE;
+}
+
+/**
+ * @brief Opens the camera, sizes the frame arena for it, and starts streaming
+ * into the driver's buffers.
+ *
+ * Frames are delivered in the camera's native format, directly from the
+ * driver's buffers. The frame arena's color buffers are only used for frames
+ * copied out of the driver's buffers.
+ */
+void v4l2_capture_setup(FramePipeline *frame_pipeline)
+{
+  open_camera();
+  initialize_frame_arena(
+      frame_pipeline,
+      camera_format.fmt.pix.height,
+      camera_format.fmt.pix.width,
+      camera_format.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV ? CV_8UC2 : CV_8UC1);
+  for (int index = 0; index < NUMBER_OF_FRAMES; ++index)
+    copy_buffers[index] = frame_pipeline->frames[index].frame_buffer;
+  frame_pipeline->frame_release_function = v4l2_capture_release;
+  copied_frame_count = 0;
+  start_camera_streaming();
+
+  write_log(
+      "V4L2 Capture: %ux%u %s, %u driver buffers, %u held before copying",
+      camera_format.fmt.pix.width,
+      camera_format.fmt.pix.height,
+      camera_format.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV ? "YUYV" : "GREY",
+      driver_buffer_count,
+      driver_buffer_count - DRIVER_BUFFER_RESERVE);
+}
+
+/**
+ * @brief Stops streaming.
+ *
+ * The driver's buffers stay mapped until the process exits, since other
+ * stages may still be holding frames that point into them.
+ */
+void v4l2_capture_teardown(FramePipeline *frame_pipeline)
+{
+  is_camera_streaming = FALSE;
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  attempt(camera_ioctl(VIDIOC_STREAMOFF, &type), "VIDIOC_STREAMOFF");
+
+  write_log("V4L2 Capture: Copied Frames: %llu", copied_frame_count);
+}
+
+/**
+ * @brief Wait for the camera driver to fill a buffer, and point the given
+ * frame at it without copying. The frame holds the buffer until it is
+ * released. Returns `TRUE` if a frame was captured before the timeout.
+ *
+ * Later stages may hold frames for a long time, such as Select Frame's
+ * history. So that the driver always has `DRIVER_BUFFER_RESERVE` buffers to
+ * fill, a frame that would take one of them is copied into its own color
+ * buffer instead, and the driver's buffer is handed straight back.
+ */
+int v4l2_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index)
+{
+  // Wait for a filled buffer.
+  struct pollfd poll_descriptor = {.fd = camera_file_descriptor, .events = POLLIN};
+  int result = poll(&poll_descriptor, 1, CAMERA_TIMEOUT_MILLISECONDS);
+  if (result == -1 && errno != EINTR)
+    print_with_errno_and_exit("poll() %s", CAMERA_DEVICE_NAME);
+  if (result <= 0)
+    return FALSE;
+
+  // Take the filled buffer from the driver.
+  struct v4l2_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.index = driver_buffer_count;
+  if (camera_ioctl(VIDIOC_DQBUF, &buffer) == -1)
+  {
+    // No buffer is ready.
+    if (errno == EAGAIN)
+      return FALSE;
+
+    // The driver reported a recoverable error, and may have dequeued an empty
+    // buffer regardless. Hand any such buffer straight back.
+    if (errno == EIO)
+    {
+      if (buffer.index < driver_buffer_count && is_driver_buffer_dequeued(buffer.index))
+        queue_driver_buffer(buffer.index);
+      return FALSE;
+    }
+    print_with_errno_and_exit("VIDIOC_DQBUF");
+  }
+
+  // Hand back a buffer the driver failed to fill.
+  if (buffer.flags & V4L2_BUF_FLAG_ERROR)
+  {
+    queue_driver_buffer(buffer.index);
+    return FALSE;
+  }
+
+  // Wrap the buffer in the frame.
+  int is_yuyv = camera_format.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV;
+  frame->format = is_yuyv ? FRAME_FORMAT_YUYV : FRAME_FORMAT_GREY;
+  cv::Mat driver_frame_buffer(
+      camera_format.fmt.pix.height,
+      camera_format.fmt.pix.width,
+      is_yuyv ? CV_8UC2 : CV_8UC1,
+      driver_buffers[buffer.index].start,
+      camera_format.fmt.pix.bytesperline);
+
+  // Copy the frame out if holding the buffer would leave the driver short.
+  unsigned int held_count = __atomic_add_fetch(&held_driver_buffer_count, 1, __ATOMIC_RELAXED);
+  if (driver_buffer_count - held_count < DRIVER_BUFFER_RESERVE)
+  {
+    frame->frame_buffer = copy_buffers[frame - frame_pipeline->frames];
+    driver_frame_buffer.copyTo(frame->frame_buffer);
+    queue_driver_buffer(buffer.index);
+    __atomic_sub_fetch(&held_driver_buffer_count, 1, __ATOMIC_RELAXED);
+    frame->driver_buffer_index = -1;
+    ++copied_frame_count;
+    return TRUE;
+  }
+
+  frame->driver_buffer_index = buffer.index;
+  frame->frame_buffer = driver_frame_buffer;
+  return TRUE;
+}
+
+/**
+ * @brief Hand a frame's buffer back to the camera driver, once the last
+ * reference to the frame is released.
+ */
+void v4l2_capture_release(FramePipeline *frame_pipeline, Frame *frame)
+{
+  if (frame->driver_buffer_index < 0)
+    return;
+
+  if (is_camera_streaming)
+    queue_driver_buffer(frame->driver_buffer_index);
+  __atomic_sub_fetch(&held_driver_buffer_count, 1, __ATOMIC_RELAXED);
+  frame->driver_buffer_index = -1;
+}
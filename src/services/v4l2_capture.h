@@ -0,0 +1,18 @@
+#ifndef V4L2_CAPTURE_H
+#define V4L2_CAPTURE_H
+
+#include "../sequencer.hpp"
+
+#define CAMERA_DEVICE_NAME "/dev/video0"
+#define CAMERA_HORIZONTAL_RESOLUTION (640)
+#define CAMERA_VERTICAL_RESOLUTION (480)
+#define DRIVER_MMAP_BUFFERS (8)
+#define DRIVER_BUFFER_RESERVE (2)
+#define CAMERA_TIMEOUT_MILLISECONDS (2000)
+
+void v4l2_capture_setup(FramePipeline *frame_pipeline);
+void v4l2_capture_teardown(FramePipeline *frame_pipeline);
+int v4l2_capture_read(FramePipeline *frame_pipeline, Frame *frame, unsigned long long frame_index);
+void v4l2_capture_release(FramePipeline *frame_pipeline, Frame *frame);
+
+#endif
@@ -5,34 +5,231 @@
  * @date 2022
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <filesystem>
 #include <iomanip>
 #include <ios>
-#include <mqueue.h>
 #include <opencv2/core/cvstd.hpp>
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <pthread.h>
 #include <sstream>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
+#include "../frame_queue.hpp"
+#include "../io_ring.hpp"
 #include "../sequencer.hpp"
 #include "../utils/error.h"
 #include "../utils/log.h"
+#include "../utils/ring_buffer.hpp"
 #include "../utils/time.h"
+#include "../worker_pool.hpp"
 #include "write_frame.h"
 
 #define OUTPUT_DIRECTORY "output"
-#define FILENAME_EXTENSION ".ppm"
+#define COLOR_FILENAME_EXTENSION ".ppm"
+#define GREY_FILENAME_EXTENSION ".pgm"
+#define PARTIAL_FILENAME_EXTENSION ".partial"
+#define WRITE_MODE WRITE_MODE_ASYNCHRONOUS
+#define MAXIMUM_WRITES_IN_FLIGHT (4)
+#define MAXIMUM_PNM_HEADER_LENGTH (32)
+#define EXIT_COMPLETION_THREAD_USER_DATA (0)
+
+/**
+ * @brief A preallocated buffer holding one encoded frame, and the file it is
+ * written to.
+ *
+ * Each slot's file is opened by the completion thread before the slot is
+ * handed back to the writer, so the writer never waits on the file system.
+ * The file is opened under a partial name, since the frame's format, and so
+ * its extension, is only known once it is encoded, and is renamed once the
+ * write completes.
+ */
+typedef struct WriteSlot
+{
+  unsigned char *buffer;
+  size_t size;
+  size_t length;
+  FrameFormat format;
+  int file_descriptor;
+  unsigned int frame_number;
+  char path[64];
+} WriteSlot;
 
 unsigned int frame_number{0};
 std::ostringstream filename_number;
+cv::Mat bgr_frame_buffer;
+
+WriteMode write_mode;
+IoRing io_ring;
+WriteSlot write_slots[MAXIMUM_WRITES_IN_FLIGHT];
+SpscRingBuffer<WriteSlot *, MAXIMUM_WRITES_IN_FLIGHT> free_write_slots;
+WriteSlot *next_write_slot;
+unsigned int next_prepared_frame_number;
+pthread_t write_completion_thread;
+unsigned long long backpressured_request_count;
+
+/**
+ * @brief Get the extension of the file a frame of the given format is written
+ * to, a PGM for grayscale frames and a PPM for color frames.
+ */
+const char *get_filename_extension(FrameFormat format)
+{
+  return format == FRAME_FORMAT_GREY ? GREY_FILENAME_EXTENSION : COLOR_FILENAME_EXTENSION;
+}
+
+/**
+ * @brief Open the file for the next frame to be written from the given slot.
+ */
+void prepare_write_slot(WriteSlot *write_slot)
+{
+  write_slot->frame_number = next_prepared_frame_number++;
+  snprintf(write_slot->path, sizeof(write_slot->path), "%s/%06u%s", OUTPUT_DIRECTORY, write_slot->frame_number, PARTIAL_FILENAME_EXTENSION);
+  write_slot->file_descriptor = open(write_slot->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (write_slot->file_descriptor < 0)
+    print_with_errno_and_exit("open() %s", write_slot->path);
+}
+
+/**
+ * @brief A thread entry point, for use with `pthread_create()`. Handles the
+ * completion of each write, and returns its slot to the writer with the next
+ * file opened, until told to exit.
+ */
+void *WriteCompletionThread(void *thread_parameters)
+{
+  FramePipeline *frame_pipeline = (FramePipeline *)thread_parameters;
+
+  while (TRUE)
+  {
+    unsigned long long user_data;
+    int result = wait_for_io_ring_completion(&io_ring, &user_data);
+    if (user_data == EXIT_COMPLETION_THREAD_USER_DATA)
+      break;
+
+    WriteSlot *write_slot = (WriteSlot *)user_data;
+    if (result < 0)
+    {
+      write_log("Write Frame - WRITE FAILED, Frame Number: %u, Error: %s", write_slot->frame_number, strerror(-result));
+      unlink(write_slot->path);
+    }
+    else if ((size_t)result < write_slot->length)
+    {
+      write_log("Write Frame - SHORT WRITE, Frame Number: %u, Written: %i of %zu", write_slot->frame_number, result, write_slot->length);
+      unlink(write_slot->path);
+    }
+    else
+    {
+      // Give the complete file its final name.
+      char path[sizeof(write_slot->path)];
+      snprintf(path, sizeof(path), "%s/%06u%s", OUTPUT_DIRECTORY, write_slot->frame_number, get_filename_extension(write_slot->format));
+      attempt(rename(write_slot->path, path), "rename() %s", write_slot->path);
+      write_log_with_timer("Write Frame - WRITE COMPLETE, Frame Number: %u", write_slot->frame_number);
+    }
+    close(write_slot->file_descriptor);
+
+    // Return the slot to the writer, and lift any backpressure now that
+    // there is room for another write.
+    prepare_write_slot(write_slot);
+    free_write_slots.try_push(write_slot);
+    frame_pipeline->is_write_backpressured.store(FALSE);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Set up the ring, the slots and their first files, and the
+ * completion thread. Falls back to synchronous writes if the kernel does not
+ * provide `io_uring`, or cannot keep the workers that carry out its writes
+ * off the real-time CPUs. Must run on the thread that submits the writes.
+ */
+void initialize_asynchronous_writes(FramePipeline *frame_pipeline)
+{
+  // Leave room in the ring for the message that stops the completion thread.
+  if (!initialize_io_ring(&io_ring, MAXIMUM_WRITES_IN_FLIGHT + 1))
+  {
+    write_log("Write Frame - IO_URING UNAVAILABLE, WRITING SYNCHRONOUSLY");
+    write_mode = WRITE_MODE_SYNCHRONOUS;
+    return;
+  }
+
+  // Buffered writes block, so the kernel hands them to workers forked from
+  // this real-time thread. Keep them with the completion thread.
+  if (!set_io_ring_worker_cpu(&io_ring, frame_pipeline->write_completion_cpu))
+  {
+    write_log("Write Frame - IO_URING WORKERS CANNOT BE PINNED, WRITING SYNCHRONOUSLY");
+    uninitialize_io_ring(&io_ring);
+    write_mode = WRITE_MODE_SYNCHRONOUS;
+    return;
+  }
+
+  // Reserve room for the largest encoding, prefaulted and locked into memory.
+  size_t size = MAXIMUM_PNM_HEADER_LENGTH + (size_t)frame_pipeline->frame_size.area() * 3;
+  next_prepared_frame_number = 0;
+  for (int index = 0; index < MAXIMUM_WRITES_IN_FLIGHT; ++index)
+  {
+    WriteSlot *write_slot = &write_slots[index];
+    write_slot->size = size;
+    write_slot->buffer = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (write_slot->buffer == MAP_FAILED)
+      print_with_errno_and_exit("mmap() write slot");
+    attempt(mlock(write_slot->buffer, size), "mlock() write slot");
+    prepare_write_slot(write_slot);
+    free_write_slots.try_push(write_slot);
+  }
+  next_write_slot = NULL;
+  backpressured_request_count = 0;
+
+  start_background_thread(
+      &write_completion_thread,
+      frame_pipeline->write_completion_cpu,
+      WriteCompletionThread,
+      (void *)frame_pipeline);
+}
+
+/**
+ * @brief Wait for the writes in flight, remove the files opened for writes
+ * that never came, and stop the completion thread.
+ */
+void uninitialize_asynchronous_writes(FramePipeline *frame_pipeline)
+{
+  // Take back every slot, waiting for those still being written.
+  int held_slot_count = 0;
+  if (next_write_slot != NULL)
+    ++held_slot_count;
+  for (int index = held_slot_count; index < MAXIMUM_WRITES_IN_FLIGHT; ++index)
+  {
+    WriteSlot *write_slot;
+    free_write_slots.pop(&write_slot);
+  }
+  next_write_slot = NULL;
+
+  submit_io_ring_nop(&io_ring, EXIT_COMPLETION_THREAD_USER_DATA);
+  errno = pthread_join(write_completion_thread, NULL);
+  if (errno)
+    print_with_errno_and_exit("pthread_join()");
+
+  for (int index = 0; index < MAXIMUM_WRITES_IN_FLIGHT; ++index)
+  {
+    WriteSlot *write_slot = &write_slots[index];
+    close(write_slot->file_descriptor);
+    unlink(write_slot->path);
+    munmap(write_slot->buffer, write_slot->size);
+  }
+  uninitialize_io_ring(&io_ring);
+  frame_pipeline->is_write_backpressured.store(FALSE);
 
-const struct timespec dequeue_timeout = {
-    .tv_sec = 5,
-    .tv_nsec = 0,
-};
+  write_log("Write Frame - Backpressured Requests: %llu", backpressured_request_count);
+}
 
 /**
- * @brief Delete old results from the output directory.
+ * @brief Delete old results from the output directory, and set up
+ * asynchronous writes, if indicated.
  */
 void write_frame_setup(FramePipeline *frame_pipeline)
 {
@@ -42,30 +239,125 @@ void write_frame_setup(FramePipeline *frame_pipeline)
   // Delete the existing contents of the output folder.
   for (const auto &entry : std::filesystem::directory_iterator(OUTPUT_DIRECTORY))
     std::filesystem::remove_all(entry.path());
+
+  write_mode = WRITE_MODE;
+  if (write_mode == WRITE_MODE_ASYNCHRONOUS)
+    initialize_asynchronous_writes(frame_pipeline);
 }
 
 /**
- * @brief Does nothing.
+ * @brief Finishes the asynchronous writes, if indicated.
  */
 void write_frame_teardown(FramePipeline *frame_pipeline)
 {
+  if (write_mode == WRITE_MODE_ASYNCHRONOUS)
+    uninitialize_asynchronous_writes(frame_pipeline);
 }
 
 /**
- * @brief Write to disk all frames currently enqueued for writing.
+ * @brief Encode the frame as a binary PNM image into the given slot's buffer.
+ * Color frames are encoded as a PPM, and grayscale frames as a PGM.
  */
-void write_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter)
+void encode_frame(Frame *frame, WriteSlot *write_slot)
+{
+  int is_grey = frame->format == FRAME_FORMAT_GREY;
+  int rows = frame->frame_buffer.rows;
+  int columns = frame->frame_buffer.cols;
+  int header_length = snprintf(
+      (char *)write_slot->buffer,
+      MAXIMUM_PNM_HEADER_LENGTH,
+      "%s\n%i %i\n255\n",
+      is_grey ? "P5" : "P6",
+      columns,
+      rows);
+
+  // Convert the pixels in place into the buffer, after the header.
+  cv::Mat image_buffer(rows, columns, is_grey ? CV_8UC1 : CV_8UC3, write_slot->buffer + header_length);
+  if (frame->format == FRAME_FORMAT_YUYV)
+    cv::cvtColor(frame->frame_buffer, image_buffer, CV_YUV2RGB_YUYV);
+  else if (frame->format == FRAME_FORMAT_BGR)
+    cv::cvtColor(frame->frame_buffer, image_buffer, CV_BGR2RGB);
+  else
+    frame->frame_buffer.copyTo(image_buffer);
+  write_slot->length = header_length + image_buffer.total() * image_buffer.elemSize();
+  write_slot->format = frame->format;
+}
+
+/**
+ * @brief Get a free slot to write the next frame from. If there is none,
+ * reports backpressure to Select Frame and returns FALSE.
+ */
+int get_next_write_slot(FramePipeline *frame_pipeline)
+{
+  if (next_write_slot == NULL && !free_write_slots.try_pop(&next_write_slot))
+  {
+    // Report backpressure before checking again, so a slot freed in between
+    // is not missed, and the completion thread lifts the report once it frees
+    // one. The fence keeps the check from being ordered ahead of the report.
+    frame_pipeline->is_write_backpressured.store(TRUE);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!free_write_slots.try_pop(&next_write_slot))
+    {
+      next_write_slot = NULL;
+      return FALSE;
+    }
+  }
+
+  // Lift any backpressure still reported, now that there is a slot.
+  frame_pipeline->is_write_backpressured.store(FALSE);
+  return TRUE;
+}
+
+/**
+ * @brief Encode and submit writes for the frames currently enqueued for
+ * writing, as long as there are free slots. Frames left waiting are written
+ * by a later request.
+ */
+void write_frames_asynchronously(FramePipeline *frame_pipeline, Service *service)
+{
+  Frame *frame;
+  while (get_next_write_slot(frame_pipeline) && try_dequeue_frame(&frame_pipeline->selected_frame_queue, &frame))
+  {
+    WriteSlot *write_slot = next_write_slot;
+    next_write_slot = NULL;
+
+    // Start write timer.
+    write_log_with_timer("Service: %i, Service Name: %s, Frame Number: %u, BEGIN WRITE", service->id, service->name, write_slot->frame_number);
+    get_current_monotonic_raw_time(&service->work_start_time);
+
+    write_log_with_timer("Write Frame - WRITING FRAME %u", write_slot->frame_number);
+    write_assignment_log_with_timer(write_slot->frame_number);
+
+    // Encode the frame, and hand the write to the kernel.
+    encode_frame(frame, write_slot);
+    release_frame(frame_pipeline, frame);
+    submit_io_ring_write(&io_ring, write_slot->file_descriptor, write_slot->buffer, write_slot->length, (unsigned long long)write_slot);
+
+    // End write timer.
+    get_current_monotonic_raw_time(&service->work_complete_time);
+    write_log_with_timer(
+        "Service: %i, Service Name: %s, Frame Number: %u, END WRITE, Request Elapsed Time: %6.9lf",
+        service->id,
+        service->name,
+        write_slot->frame_number,
+        get_elapsed_time_in_seconds(&service->work_start_time, &service->work_complete_time));
+  }
+
+  if (frame_pipeline->is_write_backpressured.load())
+    ++backpressured_request_count;
+}
+
+/**
+ * @brief Encode and write to disk all frames currently enqueued for writing,
+ * waiting for each write.
+ */
+void write_frames_synchronously(FramePipeline *frame_pipeline, Service *service)
 {
   // Dequeue the next selected frame.
   Frame *frame;
 
   // Deque and save all frames in the selected frames queue.
-  while (-1 != mq_timedreceive(
-                   frame_pipeline->selected_frame_queue,
-                   (char *)&frame,
-                   sizeof(Frame *),
-                   NULL,
-                   &dequeue_timeout))
+  while (try_dequeue_frame(&frame_pipeline->selected_frame_queue, &frame))
   {
     // Start write timer.
     write_log_with_timer("Service: %i, Service Name: %s, Frame Number: %u, BEGIN WRITE", service->id, service->name, frame_number);
@@ -78,9 +370,15 @@ void write_frame(FramePipeline *frame_pipeline, Service *service, unsigned int r
     filename_number.str("");
     filename_number.clear();
     filename_number << std::right << std::setfill('0') << std::setw(6) << frame_number;
+    cv::Mat *output_frame_buffer = &frame->frame_buffer;
+    if (frame->format == FRAME_FORMAT_YUYV)
+    {
+      cv::cvtColor(frame->frame_buffer, bgr_frame_buffer, CV_YUV2BGR_YUYV);
+      output_frame_buffer = &bgr_frame_buffer;
+    }
     cv::imwrite(
-        static_cast<std::string>(OUTPUT_DIRECTORY) + "/" + filename_number.str() + FILENAME_EXTENSION,
-        frame->frame_buffer);
+        static_cast<std::string>(OUTPUT_DIRECTORY) + "/" + filename_number.str() + get_filename_extension(frame->format),
+        *output_frame_buffer);
 
     // End write timer.
     get_current_monotonic_raw_time(&service->work_complete_time);
@@ -91,7 +389,22 @@ void write_frame(FramePipeline *frame_pipeline, Service *service, unsigned int r
         frame_number,
         get_elapsed_time_in_seconds(&service->work_start_time, &service->work_complete_time));
 
+    // Release the writer's reference to the frame.
+    release_frame(frame_pipeline, frame);
+
     // Increment the frame number.
     ++frame_number;
   }
 }
+
+/**
+ * @brief Write to disk all frames currently enqueued for writing, or, when
+ * writing asynchronously, as many as there is room for.
+ */
+void write_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter)
+{
+  if (write_mode == WRITE_MODE_ASYNCHRONOUS)
+    write_frames_asynchronously(frame_pipeline, service);
+  else
+    write_frames_synchronously(frame_pipeline, service);
+}
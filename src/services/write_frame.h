@@ -3,6 +3,21 @@
 
 #include "../sequencer.hpp"
 
+/**
+ * @brief How Write Frame writes frames to disk.
+ *
+ * `WRITE_MODE_SYNCHRONOUS` encodes and writes each frame on the service's own
+ * thread. `WRITE_MODE_ASYNCHRONOUS` encodes each frame into a preallocated
+ * buffer and hands the write to `io_uring`, with completions handled by a
+ * normal priority thread. It falls back to synchronous writes when the kernel
+ * does not provide `io_uring`.
+ */
+typedef enum WriteMode
+{
+  WRITE_MODE_SYNCHRONOUS,
+  WRITE_MODE_ASYNCHRONOUS,
+} WriteMode;
+
 void write_frame_setup(FramePipeline *frame_pipeline);
 void write_frame_teardown(FramePipeline *frame_pipeline);
 void write_frame(FramePipeline *frame_pipeline, Service *service, unsigned int request_counter);
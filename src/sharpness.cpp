@@ -0,0 +1,273 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include "luma.hpp"
+#include "sequencer.hpp"
+#include "sharpness.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief A few rows of luma, with a row of context above and below, small
+ * enough to stay in the L1 cache while it is measured.
+ */
+cv::Mat sharpness_luma_strip_buffer;
+
+#if defined(__x86_64__)
+/**
+ * @brief Sum the 32-bit lanes of a vector of squares into the 64-bit lanes of
+ * an accumulator.
+ */
+static inline __m128i accumulate_squares(__m128i sums, __m128i squares)
+{
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_add_epi64(sums, _mm_add_epi64(_mm_unpacklo_epi32(squares, zero), _mm_unpackhi_epi32(squares, zero)));
+}
+
+/**
+ * @brief Compute the Laplacian of 8 pixels, widened to 16 bits.
+ */
+static inline __m128i get_laplacian(__m128i above, __m128i below, __m128i left, __m128i center, __m128i right)
+{
+  __m128i neighbours = _mm_add_epi16(_mm_add_epi16(above, below), _mm_add_epi16(left, right));
+  return _mm_sub_epi16(_mm_slli_epi16(center, 2), neighbours);
+}
+
+/**
+ * @brief Compute the sum of the squared horizontal and vertical Sobel
+ * gradients of 8 pixels, widened to 16 bits, in pairs.
+ */
+static inline __m128i get_sobel_squares(
+    __m128i above_left,
+    __m128i above,
+    __m128i above_right,
+    __m128i left,
+    __m128i right,
+    __m128i below_left,
+    __m128i below,
+    __m128i below_right)
+{
+  __m128i corners_difference = _mm_sub_epi16(above_right, below_left);
+  __m128i other_corners_difference = _mm_sub_epi16(below_right, above_left);
+  __m128i horizontal_gradient = _mm_add_epi16(
+      _mm_add_epi16(corners_difference, other_corners_difference),
+      _mm_slli_epi16(_mm_sub_epi16(right, left), 1));
+  __m128i vertical_gradient = _mm_add_epi16(
+      _mm_sub_epi16(other_corners_difference, corners_difference),
+      _mm_slli_epi16(_mm_sub_epi16(below, above), 1));
+  return _mm_add_epi32(
+      _mm_madd_epi16(horizontal_gradient, horizontal_gradient),
+      _mm_madd_epi16(vertical_gradient, vertical_gradient));
+}
+#endif
+
+/**
+ * @brief Accumulate the sum and the sum of squares of the Laplacian of one row
+ * of luma, from the rows above and below it. The first and last pixels of the
+ * row have no neighbours to one side, so are skipped.
+ */
+void accumulate_laplacian_row(
+    const unsigned char *above_row,
+    const unsigned char *row,
+    const unsigned char *below_row,
+    int width,
+    long long *sum,
+    unsigned long long *sum_of_squares)
+{
+  int column = 1;
+
+#if defined(__x86_64__)
+  // Work on 16 pixels at a time, widened to 16 bits. A Laplacian is at most
+  // 1020 in magnitude, so its squares fit in 32 bits in pairs.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i sums = _mm_setzero_si128();
+  __m128i squares = _mm_setzero_si128();
+  for (; column + 17 <= width; column += 16)
+  {
+    __m128i above = _mm_loadu_si128((const __m128i *)(above_row + column));
+    __m128i below = _mm_loadu_si128((const __m128i *)(below_row + column));
+    __m128i left = _mm_loadu_si128((const __m128i *)(row + column - 1));
+    __m128i center = _mm_loadu_si128((const __m128i *)(row + column));
+    __m128i right = _mm_loadu_si128((const __m128i *)(row + column + 1));
+    __m128i low_laplacian = get_laplacian(
+        _mm_unpacklo_epi8(above, zero),
+        _mm_unpacklo_epi8(below, zero),
+        _mm_unpacklo_epi8(left, zero),
+        _mm_unpacklo_epi8(center, zero),
+        _mm_unpacklo_epi8(right, zero));
+    __m128i high_laplacian = get_laplacian(
+        _mm_unpackhi_epi8(above, zero),
+        _mm_unpackhi_epi8(below, zero),
+        _mm_unpackhi_epi8(left, zero),
+        _mm_unpackhi_epi8(center, zero),
+        _mm_unpackhi_epi8(right, zero));
+    sums = _mm_add_epi32(sums, _mm_madd_epi16(_mm_add_epi16(low_laplacian, high_laplacian), ones));
+    squares = accumulate_squares(squares, _mm_madd_epi16(low_laplacian, low_laplacian));
+    squares = accumulate_squares(squares, _mm_madd_epi16(high_laplacian, high_laplacian));
+  }
+  int row_sums[4];
+  _mm_storeu_si128((__m128i *)row_sums, sums);
+  *sum += (long long)row_sums[0] + row_sums[1] + row_sums[2] + row_sums[3];
+  *sum_of_squares += _mm_cvtsi128_si64(squares) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(squares, squares));
+#elif defined(__ARM_NEON)
+  // Work on 8 pixels at a time, widened to 16 bits.
+  int32x4_t sums = vdupq_n_s32(0);
+  uint64x2_t squares = vdupq_n_u64(0);
+  for (; column + 9 <= width; column += 8)
+  {
+    int16x8_t neighbours = vreinterpretq_s16_u16(vaddq_u16(
+        vaddl_u8(vld1_u8(above_row + column), vld1_u8(below_row + column)),
+        vaddl_u8(vld1_u8(row + column - 1), vld1_u8(row + column + 1))));
+    int16x8_t center = vreinterpretq_s16_u16(vshll_n_u8(vld1_u8(row + column), 2));
+    int16x8_t laplacian = vsubq_s16(center, neighbours);
+    sums = vpadalq_s16(sums, laplacian);
+    int32x4_t pair_squares = vmlal_s16(vmull_s16(vget_low_s16(laplacian), vget_low_s16(laplacian)), vget_high_s16(laplacian), vget_high_s16(laplacian));
+    squares = vpadalq_u32(squares, vreinterpretq_u32_s32(pair_squares));
+  }
+  int64x2_t wide_sums = vpaddlq_s32(sums);
+  *sum += vgetq_lane_s64(wide_sums, 0) + vgetq_lane_s64(wide_sums, 1);
+  *sum_of_squares += vgetq_lane_u64(squares, 0) + vgetq_lane_u64(squares, 1);
+#endif
+
+  // Handle the remaining pixels one at a time.
+  for (; column < width - 1; ++column)
+  {
+    int laplacian = 4 * row[column] - above_row[column] - below_row[column] - row[column - 1] - row[column + 1];
+    *sum += laplacian;
+    *sum_of_squares += laplacian * laplacian;
+  }
+}
+
+/**
+ * @brief Sum the squared Sobel gradient magnitudes of one row of luma, from
+ * the rows above and below it. The first and last pixels of the row have no
+ * neighbours to one side, so are skipped.
+ */
+unsigned long long accumulate_tenengrad_row(
+    const unsigned char *above_row,
+    const unsigned char *row,
+    const unsigned char *below_row,
+    int width)
+{
+  unsigned long long sum = 0;
+  int column = 1;
+
+#if defined(__x86_64__)
+  // Work on 16 pixels at a time, widened to 16 bits. A Sobel gradient is at
+  // most 1020 in magnitude, so the squares of both fit in 32 bits in pairs.
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sums = _mm_setzero_si128();
+  for (; column + 17 <= width; column += 16)
+  {
+    __m128i above_left = _mm_loadu_si128((const __m128i *)(above_row + column - 1));
+    __m128i above = _mm_loadu_si128((const __m128i *)(above_row + column));
+    __m128i above_right = _mm_loadu_si128((const __m128i *)(above_row + column + 1));
+    __m128i left = _mm_loadu_si128((const __m128i *)(row + column - 1));
+    __m128i right = _mm_loadu_si128((const __m128i *)(row + column + 1));
+    __m128i below_left = _mm_loadu_si128((const __m128i *)(below_row + column - 1));
+    __m128i below = _mm_loadu_si128((const __m128i *)(below_row + column));
+    __m128i below_right = _mm_loadu_si128((const __m128i *)(below_row + column + 1));
+    sums = accumulate_squares(sums, get_sobel_squares(
+        _mm_unpacklo_epi8(above_left, zero),
+        _mm_unpacklo_epi8(above, zero),
+        _mm_unpacklo_epi8(above_right, zero),
+        _mm_unpacklo_epi8(left, zero),
+        _mm_unpacklo_epi8(right, zero),
+        _mm_unpacklo_epi8(below_left, zero),
+        _mm_unpacklo_epi8(below, zero),
+        _mm_unpacklo_epi8(below_right, zero)));
+    sums = accumulate_squares(sums, get_sobel_squares(
+        _mm_unpackhi_epi8(above_left, zero),
+        _mm_unpackhi_epi8(above, zero),
+        _mm_unpackhi_epi8(above_right, zero),
+        _mm_unpackhi_epi8(left, zero),
+        _mm_unpackhi_epi8(right, zero),
+        _mm_unpackhi_epi8(below_left, zero),
+        _mm_unpackhi_epi8(below, zero),
+        _mm_unpackhi_epi8(below_right, zero)));
+  }
+  sum = _mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+#elif defined(__ARM_NEON)
+  // Work on 8 pixels at a time, widened to 16 bits.
+  uint64x2_t sums = vdupq_n_u64(0);
+  for (; column + 9 <= width; column += 8)
+  {
+    int16x8_t corners_difference = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(above_row + column + 1), vld1_u8(below_row + column - 1)));
+    int16x8_t other_corners_difference = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(below_row + column + 1), vld1_u8(above_row + column - 1)));
+    int16x8_t horizontal_gradient = vaddq_s16(
+        vaddq_s16(corners_difference, other_corners_difference),
+        vshlq_n_s16(vreinterpretq_s16_u16(vsubl_u8(vld1_u8(row + column + 1), vld1_u8(row + column - 1))), 1));
+    int16x8_t vertical_gradient = vaddq_s16(
+        vsubq_s16(other_corners_difference, corners_difference),
+        vshlq_n_s16(vreinterpretq_s16_u16(vsubl_u8(vld1_u8(below_row + column), vld1_u8(above_row + column))), 1));
+    int32x4_t squares = vmull_s16(vget_low_s16(horizontal_gradient), vget_low_s16(horizontal_gradient));
+    squares = vmlal_s16(squares, vget_high_s16(horizontal_gradient), vget_high_s16(horizontal_gradient));
+    sums = vpadalq_u32(sums, vreinterpretq_u32_s32(squares));
+    squares = vmull_s16(vget_low_s16(vertical_gradient), vget_low_s16(vertical_gradient));
+    squares = vmlal_s16(squares, vget_high_s16(vertical_gradient), vget_high_s16(vertical_gradient));
+    sums = vpadalq_u32(sums, vreinterpretq_u32_s32(squares));
+  }
+  sum = vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+#endif
+
+  // Handle the remaining pixels one at a time.
+  for (; column < width - 1; ++column)
+  {
+    int horizontal_gradient =
+        (above_row[column + 1] + 2 * row[column + 1] + below_row[column + 1]) -
+        (above_row[column - 1] + 2 * row[column - 1] + below_row[column - 1]);
+    int vertical_gradient =
+        (below_row[column - 1] + 2 * below_row[column] + below_row[column + 1]) -
+        (above_row[column - 1] + 2 * above_row[column] + above_row[column + 1]);
+    sum += horizontal_gradient * horizontal_gradient + vertical_gradient * vertical_gradient;
+  }
+
+  return sum;
+}
+
+/**
+ * @brief Measure the sharpness of a frame's region of interest, a strip of
+ * luma at a time. The pixels on the region's border are skipped, since they
+ * have no neighbours to one side within it.
+ */
+double measure_frame_sharpness(Frame *frame, SharpnessMeasure sharpness_measure)
+{
+  const cv::Rect &region_of_interest = frame->region_of_interest;
+  int columns = region_of_interest.width;
+  if (columns < 3 || region_of_interest.height < 3)
+    return 0;
+  sharpness_luma_strip_buffer.create(LUMA_STRIP_ROWS + 2, columns, CV_8UC1);
+
+  long long sum = 0;
+  unsigned long long sum_of_squares = 0;
+  for (int row_offset = 1; row_offset < region_of_interest.height - 1; row_offset += LUMA_STRIP_ROWS)
+  {
+    // Extract the strip with the row above and below it.
+    int row_count = std::min(LUMA_STRIP_ROWS, region_of_interest.height - 1 - row_offset);
+    cv::Rect region(region_of_interest.x, region_of_interest.y + row_offset - 1, columns, row_count + 2);
+    cv::Mat luma_strip = get_luma_region(frame, region, sharpness_luma_strip_buffer.rowRange(0, row_count + 2));
+
+    for (int row = 1; row <= row_count; ++row)
+    {
+      if (sharpness_measure == SHARPNESS_MEASURE_LAPLACIAN_VARIANCE)
+        accumulate_laplacian_row(luma_strip.ptr(row - 1), luma_strip.ptr(row), luma_strip.ptr(row + 1), columns, &sum, &sum_of_squares);
+      else
+        sum_of_squares += accumulate_tenengrad_row(luma_strip.ptr(row - 1), luma_strip.ptr(row), luma_strip.ptr(row + 1), columns);
+    }
+  }
+
+  double pixel_count = (double)(columns - 2) * (region_of_interest.height - 2);
+  double mean = sum / pixel_count;
+  return sum_of_squares / pixel_count - mean * mean;
+}
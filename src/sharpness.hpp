@@ -0,0 +1,23 @@
+#ifndef SHARPNESS_H
+#define SHARPNESS_H
+
+#include "sequencer.hpp"
+
+/**
+ * @brief How the sharpness of a frame is measured.
+ *
+ * `SHARPNESS_MEASURE_LAPLACIAN_VARIANCE` is the variance of the luma's
+ * 4-neighbour Laplacian, which falls as edges blur.
+ * `SHARPNESS_MEASURE_TENENGRAD` is the mean squared magnitude of the luma's
+ * Sobel gradient, which also falls as edges blur but is less sensitive to
+ * noise in flat areas.
+ */
+typedef enum SharpnessMeasure
+{
+  SHARPNESS_MEASURE_LAPLACIAN_VARIANCE,
+  SHARPNESS_MEASURE_TENENGRAD,
+} SharpnessMeasure;
+
+double measure_frame_sharpness(Frame *frame, SharpnessMeasure sharpness_measure);
+
+#endif
@@ -0,0 +1,287 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include "sequencer.hpp"
+#include "tick_tracker.hpp"
+#include "utils/error.h"
+#include "utils/log.h"
+#include "utils/time.h"
+
+#define TICK_TRACKER_LOCK_TICKS (3)
+#define TICK_TRACKER_UNLOCK_MISSES (2)
+#define TICK_TRACKER_PERIOD_TOLERANCE (0.1)
+#define TICK_TRACKER_PHASE_GAIN (0.3)
+#define TICK_TRACKER_PERIOD_GAIN (0.05)
+#define TICK_TRACKER_FRAME_INTERVAL_SMOOTHING (0.125)
+#define TICK_TRANSITION_WINDOW (0.15)
+#define TICK_STABLE_WINDOW_START (0.3)
+#define TICK_STABLE_WINDOW_END (0.8)
+
+/**
+ * @brief Initialize a tick tracker, searching for ticks the given nominal
+ * period apart.
+ */
+void initialize_tick_tracker(TickTracker *tick_tracker, double nominal_period)
+{
+  pthread_mutexattr_t mutex_attributes;
+  errno = pthread_mutexattr_init(&mutex_attributes);
+  if (errno)
+    print_with_errno_and_exit("pthread_mutexattr_init()");
+  errno = pthread_mutexattr_setprotocol(&mutex_attributes, PTHREAD_PRIO_INHERIT);
+  if (errno)
+    print_with_errno_and_exit("pthread_mutexattr_setprotocol()");
+  errno = pthread_mutex_init(&tick_tracker->mutex, &mutex_attributes);
+  if (errno)
+    print_with_errno_and_exit("pthread_mutex_init()");
+  pthread_mutexattr_destroy(&mutex_attributes);
+
+  tick_tracker->nominal_period = nominal_period;
+  tick_tracker->period = nominal_period;
+  tick_tracker->next_tick_time = 0;
+  tick_tracker->previous_tick_time = 0;
+  tick_tracker->previous_frame_time = 0;
+  tick_tracker->frame_interval = 0;
+  tick_tracker->is_locked = FALSE;
+  tick_tracker->on_time_tick_count = 0;
+  tick_tracker->missed_tick_count = 0;
+  tick_tracker->maximum_critical_section_nanoseconds = 0;
+}
+
+/**
+ * @brief Release the resources used by a tick tracker.
+ */
+void uninitialize_tick_tracker(TickTracker *tick_tracker)
+{
+  pthread_mutex_destroy(&tick_tracker->mutex);
+}
+
+/**
+ * @brief Lock a tick tracker, and note when its critical section started.
+ */
+void lock_tick_tracker(TickTracker *tick_tracker, struct timespec *lock_time)
+{
+  errno = pthread_mutex_lock(&tick_tracker->mutex);
+  if (errno)
+    print_with_errno_and_exit("pthread_mutex_lock()");
+  get_current_monotonic_raw_time(lock_time);
+}
+
+/**
+ * @brief Unlock a tick tracker, keeping track of its longest critical section,
+ * which bounds how long one service can block another on it.
+ */
+void unlock_tick_tracker(TickTracker *tick_tracker, struct timespec *lock_time)
+{
+  struct timespec unlock_time;
+  get_current_monotonic_raw_time(&unlock_time);
+  long long critical_section_nanoseconds = get_elapsed_time_in_nanoseconds(lock_time, &unlock_time);
+  if (critical_section_nanoseconds > tick_tracker->maximum_critical_section_nanoseconds)
+    tick_tracker->maximum_critical_section_nanoseconds = critical_section_nanoseconds;
+
+  errno = pthread_mutex_unlock(&tick_tracker->mutex);
+  if (errno)
+    print_with_errno_and_exit("pthread_mutex_unlock()");
+}
+
+/**
+ * @brief Get how far from its predicted time a tick may be detected and still
+ * count as on time. A tick is only seen on the first frame after it, so the
+ * tolerance is never less than the interval between frames.
+ */
+double get_tick_tolerance(TickTracker *tick_tracker)
+{
+  return fmax(TICK_TRACKER_PERIOD_TOLERANCE * tick_tracker->nominal_period, tick_tracker->frame_interval);
+}
+
+/**
+ * @brief Drop the tracker's lock and search for ticks again, starting from
+ * the given tick.
+ */
+void lose_tick_lock(TickTracker *tick_tracker, double tick_time, const char *reason)
+{
+  write_log_with_timer("Tick Tracker - LOST LOCK, %s", reason);
+  tick_tracker->is_locked = FALSE;
+  tick_tracker->period = tick_tracker->nominal_period;
+  tick_tracker->previous_tick_time = tick_time;
+  tick_tracker->on_time_tick_count = 0;
+  tick_tracker->missed_tick_count = 0;
+}
+
+/**
+ * @brief Count a predicted tick that did not arrive on time, losing lock
+ * after too many in a row.
+ */
+void miss_tick(TickTracker *tick_tracker, double tick_time, const char *reason)
+{
+  ++tick_tracker->missed_tick_count;
+  write_log_with_timer("Tick Tracker - %s, Missed: %u", reason, tick_tracker->missed_tick_count);
+  if (tick_tracker->missed_tick_count >= TICK_TRACKER_UNLOCK_MISSES)
+    lose_tick_lock(tick_tracker, tick_time, reason);
+}
+
+/**
+ * @brief Fold a detected tick into the tracker.
+ *
+ * While searching, the tracker locks once enough consecutive ticks arrive
+ * about a nominal period apart, taking their mean interval as the period.
+ * While locked, an on-time tick pulls the predicted phase and period toward
+ * it, as in a second-order phase-locked loop, and an off-time tick is counted
+ * as a miss.
+ */
+void record_tick(TickTracker *tick_tracker, double tick_time)
+{
+  if (!tick_tracker->is_locked)
+  {
+    double interval = tick_time - tick_tracker->previous_tick_time;
+    if (tick_tracker->previous_tick_time > 0 && fabs(interval - tick_tracker->nominal_period) <= get_tick_tolerance(tick_tracker))
+    {
+      ++tick_tracker->on_time_tick_count;
+      tick_tracker->period += (interval - tick_tracker->period) / tick_tracker->on_time_tick_count;
+    }
+    else
+    {
+      tick_tracker->on_time_tick_count = 0;
+      tick_tracker->period = tick_tracker->nominal_period;
+    }
+    tick_tracker->previous_tick_time = tick_time;
+
+    if (tick_tracker->on_time_tick_count >= TICK_TRACKER_LOCK_TICKS)
+    {
+      tick_tracker->is_locked = TRUE;
+      tick_tracker->next_tick_time = tick_time + tick_tracker->period;
+      tick_tracker->missed_tick_count = 0;
+      write_log_with_timer("Tick Tracker - LOCKED, Period: %f", tick_tracker->period);
+    }
+    return;
+  }
+
+  double phase_error = tick_time - tick_tracker->next_tick_time;
+  if (fabs(phase_error) > get_tick_tolerance(tick_tracker))
+  {
+    miss_tick(tick_tracker, tick_time, "OFF-TIME TICK");
+    return;
+  }
+
+  // Steer toward the tick, keeping the period near the nominal period.
+  double maximum_period_error = TICK_TRACKER_PERIOD_TOLERANCE * tick_tracker->nominal_period;
+  tick_tracker->period = fmin(
+      fmax(tick_tracker->period + TICK_TRACKER_PERIOD_GAIN * phase_error, tick_tracker->nominal_period - maximum_period_error),
+      tick_tracker->nominal_period + maximum_period_error);
+  tick_tracker->next_tick_time += TICK_TRACKER_PHASE_GAIN * phase_error + tick_tracker->period;
+  tick_tracker->previous_tick_time = tick_time;
+  tick_tracker->missed_tick_count = 0;
+  write_log_with_timer("Tick Tracker - Phase Error: %f, Period: %f", phase_error, tick_tracker->period);
+}
+
+/**
+ * @brief Update the tracker with the next frame, whether the clock is in the
+ * middle of a tick, and the time of a tick that has just been timed, if
+ * positive.
+ *
+ * While locked, a predicted tick that passes without a tick being timed counts
+ * as a miss, unless the clock is still ticking, since a tick may only be timed
+ * once it is over. Returns TRUE when such a tick passed and the tracker kept
+ * its lock, giving the tick's predicted time.
+ */
+int update_tick_tracker(
+    TickTracker *tick_tracker,
+    struct timespec *frame_time,
+    int is_ticking,
+    double tick_time,
+    double *missed_tick_time)
+{
+  int is_tick_missed = FALSE;
+  double time = get_time_in_seconds(frame_time);
+
+  struct timespec lock_time;
+  lock_tick_tracker(tick_tracker, &lock_time);
+
+  // Follow the interval between frames.
+  if (tick_tracker->previous_frame_time > 0)
+  {
+    double frame_interval = time - tick_tracker->previous_frame_time;
+    if (tick_tracker->frame_interval == 0)
+      tick_tracker->frame_interval = frame_interval;
+    else
+      tick_tracker->frame_interval += TICK_TRACKER_FRAME_INTERVAL_SMOOTHING * (frame_interval - tick_tracker->frame_interval);
+  }
+  tick_tracker->previous_frame_time = time;
+
+  if (tick_time > 0)
+    record_tick(tick_tracker, tick_time);
+  else if (!is_ticking && tick_tracker->is_locked && time > tick_tracker->next_tick_time + get_tick_tolerance(tick_tracker))
+  {
+    // Keep predicting through the missed tick, in case it was only too faint
+    // to detect.
+    *missed_tick_time = tick_tracker->next_tick_time;
+    tick_tracker->next_tick_time += tick_tracker->period;
+    miss_tick(tick_tracker, tick_tracker->previous_tick_time, "TICK NOT DETECTED");
+    is_tick_missed = tick_tracker->is_locked;
+  }
+
+  unlock_tick_tracker(tick_tracker, &lock_time);
+
+  return is_tick_missed;
+}
+
+/**
+ * @brief Get where a frame captured at the given time falls relative to the
+ * predicted ticks.
+ *
+ * The transition window is never narrower than the interval between frames,
+ * so at low frame rates every frame near a tick is measured in full.
+ */
+TickWindow get_tick_window(TickTracker *tick_tracker, struct timespec *frame_time)
+{
+  double time = get_time_in_seconds(frame_time);
+
+  struct timespec lock_time;
+  lock_tick_tracker(tick_tracker, &lock_time);
+
+  TickWindow tick_window = TICK_WINDOW_UNLOCKED;
+  if (tick_tracker->is_locked)
+  {
+    // Find the frame's phase within the predicted period, from 0 at one tick
+    // to 1 at the next.
+    double phase = (time - tick_tracker->next_tick_time) / tick_tracker->period;
+    phase -= floor(phase);
+    double transition_window = fmax(TICK_TRANSITION_WINDOW, tick_tracker->frame_interval / tick_tracker->period);
+
+    if (phase <= transition_window || phase >= 1.0 - transition_window)
+      tick_window = TICK_WINDOW_TRANSITION;
+    else if (phase >= TICK_STABLE_WINDOW_START && phase <= TICK_STABLE_WINDOW_END)
+      tick_window = TICK_WINDOW_STABLE;
+    else
+      tick_window = TICK_WINDOW_IDLE;
+  }
+
+  unlock_tick_tracker(tick_tracker, &lock_time);
+
+  return tick_window;
+}
+
+/**
+ * @brief Get a tick window's name, for logging.
+ */
+const char *get_tick_window_name(TickWindow tick_window)
+{
+  switch (tick_window)
+  {
+  case TICK_WINDOW_UNLOCKED:
+    return "UNLOCKED";
+  case TICK_WINDOW_TRANSITION:
+    return "TRANSITION";
+  case TICK_WINDOW_STABLE:
+    return "STABLE";
+  case TICK_WINDOW_IDLE:
+    return "IDLE";
+  }
+  return "UNKNOWN";
+}
@@ -0,0 +1,18 @@
+#ifndef TICK_TRACKER_H
+#define TICK_TRACKER_H
+
+#include <time.h>
+#include "sequencer.hpp"
+
+void initialize_tick_tracker(TickTracker *tick_tracker, double nominal_period);
+void uninitialize_tick_tracker(TickTracker *tick_tracker);
+int update_tick_tracker(
+    TickTracker *tick_tracker,
+    struct timespec *frame_time,
+    int is_ticking,
+    double tick_time,
+    double *missed_tick_time);
+TickWindow get_tick_window(TickTracker *tick_tracker, struct timespec *frame_time);
+const char *get_tick_window_name(TickWindow tick_window);
+
+#endif
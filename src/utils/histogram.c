@@ -0,0 +1,130 @@
+#include <string.h>
+#include "histogram.h"
+
+#define HISTOGRAM_MAXIMUM_VALUE ((1ULL << HISTOGRAM_VALUE_BITS) - 1)
+
+/**
+ * @brief Get the index of the bucket that holds the given value.
+ */
+static unsigned int get_bucket_index(unsigned long long value)
+{
+  if (value < HISTOGRAM_SUB_BUCKET_COUNT)
+    return (unsigned int)value;
+
+  // Values in [2^(n + S), 2^(n + S + 1)) share `S` sub-buckets of width 2^n.
+  unsigned int exponent = (63 - __builtin_clzll(value)) - HISTOGRAM_SUB_BUCKET_BITS;
+  unsigned int sub_bucket = (unsigned int)(value >> exponent) - HISTOGRAM_SUB_BUCKET_COUNT;
+  return (exponent + 1) * HISTOGRAM_SUB_BUCKET_COUNT + sub_bucket;
+}
+
+/**
+ * @brief Get the largest value that is held by the bucket with the given
+ * index.
+ */
+static unsigned long long get_bucket_highest_value(unsigned int index)
+{
+  if (index < HISTOGRAM_SUB_BUCKET_COUNT)
+    return index;
+
+  unsigned int exponent = index / HISTOGRAM_SUB_BUCKET_COUNT - 1;
+  unsigned long long sub_bucket = index % HISTOGRAM_SUB_BUCKET_COUNT;
+  return ((sub_bucket + HISTOGRAM_SUB_BUCKET_COUNT + 1) << exponent) - 1;
+}
+
+/**
+ * @brief Reset a histogram to hold no values.
+ */
+void initialize_histogram(Histogram *histogram)
+{
+  memset(histogram, 0, sizeof(Histogram));
+  histogram->minimum = HISTOGRAM_MAXIMUM_VALUE;
+}
+
+/**
+ * @brief Record a value in a histogram. Negative values are recorded as zero,
+ * and values beyond the histogram's range are recorded as its maximum.
+ */
+void record_histogram_value(Histogram *histogram, long long value)
+{
+  unsigned long long clamped_value = value < 0 ? 0 : (unsigned long long)value;
+  if (clamped_value > HISTOGRAM_MAXIMUM_VALUE)
+    clamped_value = HISTOGRAM_MAXIMUM_VALUE;
+
+  __atomic_fetch_add(&histogram->counts[get_bucket_index(clamped_value)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->total, clamped_value, __ATOMIC_RELAXED);
+  if (clamped_value < __atomic_load_n(&histogram->minimum, __ATOMIC_RELAXED))
+    __atomic_store_n(&histogram->minimum, clamped_value, __ATOMIC_RELAXED);
+  if (clamped_value > __atomic_load_n(&histogram->maximum, __ATOMIC_RELAXED))
+    __atomic_store_n(&histogram->maximum, clamped_value, __ATOMIC_RELAXED);
+
+  // Publish the count last, so a reader never sees more values than buckets.
+  __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Get the number of values recorded in a histogram.
+ */
+unsigned long long get_histogram_count(Histogram *histogram)
+{
+  return __atomic_load_n(&histogram->count, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Get the smallest value recorded in a histogram, or zero if it is
+ * empty.
+ */
+unsigned long long get_histogram_minimum(Histogram *histogram)
+{
+  if (get_histogram_count(histogram) == 0)
+    return 0;
+  return __atomic_load_n(&histogram->minimum, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the largest value recorded in a histogram.
+ */
+unsigned long long get_histogram_maximum(Histogram *histogram)
+{
+  return __atomic_load_n(&histogram->maximum, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the mean of the values recorded in a histogram, or zero if it is
+ * empty.
+ */
+double get_histogram_mean(Histogram *histogram)
+{
+  unsigned long long count = get_histogram_count(histogram);
+  if (count == 0)
+    return 0;
+  return (double)__atomic_load_n(&histogram->total, __ATOMIC_RELAXED) / (double)count;
+}
+
+/**
+ * @brief Get an upper bound on the given percentile, from 0 to 100, of the
+ * values recorded in a histogram, or zero if it is empty.
+ */
+unsigned long long get_histogram_percentile(Histogram *histogram, double percentile)
+{
+  unsigned long long count = get_histogram_count(histogram);
+  if (count == 0)
+    return 0;
+
+  // Find the bucket holding the value at the requested rank.
+  unsigned long long rank = (unsigned long long)((percentile / 100.0) * (double)count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  unsigned long long cumulative_count = 0;
+  for (unsigned int index = 0; index < HISTOGRAM_BUCKET_COUNT; ++index)
+  {
+    cumulative_count += __atomic_load_n(&histogram->counts[index], __ATOMIC_RELAXED);
+    if (cumulative_count >= rank)
+    {
+      unsigned long long value = get_bucket_highest_value(index);
+      unsigned long long maximum = get_histogram_maximum(histogram);
+      return value < maximum ? value : maximum;
+    }
+  }
+
+  return get_histogram_maximum(histogram);
+}
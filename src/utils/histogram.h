@@ -0,0 +1,35 @@
+#ifndef UTILS_HISTOGRAM_H
+#define UTILS_HISTOGRAM_H
+
+#define HISTOGRAM_SUB_BUCKET_BITS (5)
+#define HISTOGRAM_SUB_BUCKET_COUNT (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_VALUE_BITS (48)
+#define HISTOGRAM_BUCKET_COUNT ((HISTOGRAM_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKET_COUNT)
+
+/**
+ * @brief A log-linear histogram of non-negative values, in the style of an HDR
+ * histogram. Values are bucketed with a relative precision of
+ * 1 / `HISTOGRAM_SUB_BUCKET_COUNT`.
+ *
+ * Recording is lock-free and intended for a single writer. Readers may take
+ * statistics concurrently, but only see a consistent snapshot once the writer
+ * has stopped.
+ */
+typedef struct Histogram
+{
+  unsigned long long counts[HISTOGRAM_BUCKET_COUNT];
+  unsigned long long count;
+  unsigned long long total;
+  unsigned long long minimum;
+  unsigned long long maximum;
+} Histogram;
+
+void initialize_histogram(Histogram *histogram);
+void record_histogram_value(Histogram *histogram, long long value);
+unsigned long long get_histogram_count(Histogram *histogram);
+unsigned long long get_histogram_minimum(Histogram *histogram);
+unsigned long long get_histogram_maximum(Histogram *histogram);
+double get_histogram_mean(Histogram *histogram);
+unsigned long long get_histogram_percentile(Histogram *histogram, double percentile);
+
+#endif
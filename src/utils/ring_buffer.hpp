@@ -0,0 +1,199 @@
+#ifndef UTILS_RING_BUFFER_H
+#define UTILS_RING_BUFFER_H
+
+#include <atomic>
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "error.h"
+#include "time.h"
+
+#define CACHE_LINE_SIZE (64)
+
+/**
+ * @brief A bounded, lock-free, single-producer single-consumer ring buffer.
+ *
+ * The producer's and consumer's indices live on separate cache lines, and each
+ * side caches the other's index so that it only touches the other's cache line
+ * when the buffer appears full or empty. The `try_` methods never block. The
+ * blocking methods sleep on a futex only when the buffer is empty or full, and
+ * the other side only makes a wake system call when someone is asleep.
+ *
+ * Exactly one thread may push and one thread may pop at a time. Ownership of
+ * either side may be handed to another thread if the handoff itself is
+ * synchronized.
+ */
+template <typename T, uint32_t Capacity>
+class SpscRingBuffer
+{
+public:
+  /**
+   * @brief Push a value if there is room. Returns whether it was pushed.
+   */
+  bool try_push(const T &value)
+  {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail - cached_head >= Capacity)
+    {
+      cached_head = head.load(std::memory_order_acquire);
+      if (tail - cached_head >= Capacity)
+        return false;
+    }
+
+    slots[tail & SLOT_MASK] = value;
+    this->tail.store(tail + 1, std::memory_order_release);
+
+    // Wake the consumer if it is asleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (is_consumer_waiting.load(std::memory_order_relaxed))
+      wake(&this->tail);
+    return true;
+  }
+
+  /**
+   * @brief Pop a value if there is one. Returns whether one was popped.
+   */
+  bool try_pop(T *value)
+  {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    if (head == cached_tail)
+    {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (head == cached_tail)
+        return false;
+    }
+
+    *value = slots[head & SLOT_MASK];
+    this->head.store(head + 1, std::memory_order_release);
+
+    // Wake the producer if it is asleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (is_producer_waiting.load(std::memory_order_relaxed))
+      wake(&this->head);
+    return true;
+  }
+
+  /**
+   * @brief Push a value, blocking until there is room.
+   */
+  void push(const T &value)
+  {
+    while (!try_push(value))
+    {
+      // Sleep until the consumer moves the head, unless it already has.
+      uint32_t head = this->head.load(std::memory_order_relaxed);
+      is_producer_waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (tail.load(std::memory_order_relaxed) - this->head.load(std::memory_order_relaxed) >= Capacity)
+        wait(&this->head, head, NULL);
+      is_producer_waiting.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Pop a value, blocking until there is one.
+   */
+  void pop(T *value)
+  {
+    timed_pop(value, NULL);
+  }
+
+  /**
+   * @brief Pop a value, blocking until there is one or the given relative
+   * timeout elapses. A `NULL` timeout never elapses. Returns whether a value
+   * was popped.
+   */
+  bool timed_pop(T *value, const struct timespec *timeout)
+  {
+    struct timespec deadline, remaining;
+    if (timeout != NULL)
+    {
+      get_current_monotonic_time(&deadline);
+      add_nanoseconds_to_timespec(&deadline, get_time_in_nanoseconds((struct timespec *)timeout));
+    }
+
+    while (!try_pop(value))
+    {
+      // Give up once the deadline passes.
+      if (timeout != NULL)
+      {
+        get_current_monotonic_time(&remaining);
+        get_elapsed_time(&remaining, &deadline, &remaining);
+        if (remaining.tv_sec < 0)
+          return false;
+      }
+
+      // Sleep until the producer moves the tail, unless it already has.
+      uint32_t tail = this->tail.load(std::memory_order_relaxed);
+      is_consumer_waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (this->tail.load(std::memory_order_relaxed) == head.load(std::memory_order_relaxed))
+        wait(&this->tail, tail, timeout != NULL ? &remaining : NULL);
+      is_consumer_waiting.store(0, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Get the number of values in the buffer. Only exact when called by
+   * the producer or consumer.
+   */
+  uint32_t size() const
+  {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+
+private:
+  /**
+   * @brief Get the smallest power of two that is at least the given value, so
+   * that the free-running indices can wrap around without a division.
+   */
+  static constexpr uint32_t get_slot_count(uint32_t value)
+  {
+    uint32_t slot_count = 1;
+    while (slot_count < value)
+      slot_count <<= 1;
+    return slot_count;
+  }
+
+  static constexpr uint32_t SLOT_COUNT = get_slot_count(Capacity);
+  static constexpr uint32_t SLOT_MASK = SLOT_COUNT - 1;
+
+  /**
+   * @brief Sleep while the given index holds the expected value, or until the
+   * given relative timeout elapses.
+   */
+  static void wait(std::atomic<uint32_t> *index, uint32_t expected_value, const struct timespec *timeout)
+  {
+    long result = syscall(SYS_futex, (uint32_t *)index, FUTEX_WAIT_PRIVATE, expected_value, timeout, NULL, 0);
+    if (result == -1 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+      print_with_errno_and_exit("futex() FUTEX_WAIT");
+  }
+
+  /**
+   * @brief Wake the thread sleeping on the given index.
+   */
+  static void wake(std::atomic<uint32_t> *index)
+  {
+    attempt(
+        syscall(SYS_futex, (uint32_t *)index, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0),
+        "futex() FUTEX_WAKE");
+  }
+
+  // Written by the producer.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail{0};
+  uint32_t cached_head{0};
+  std::atomic<uint32_t> is_producer_waiting{0};
+
+  // Written by the consumer.
+  alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head{0};
+  uint32_t cached_tail{0};
+  std::atomic<uint32_t> is_consumer_waiting{0};
+
+  alignas(CACHE_LINE_SIZE) T slots[SLOT_COUNT];
+};
+
+#endif
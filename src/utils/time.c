@@ -13,7 +13,16 @@ void get_current_monotonic_raw_time(struct timespec *result)
 }
 
 /**
- * @brief Get the current monotonic clock time from the computer.
+ * @brief Get the current monotonic clock time from the computer. Unlike
+ * `CLOCK_MONOTONIC_RAW`, this clock may be used with `clock_nanosleep()`.
+ */
+void get_current_monotonic_time(struct timespec *result)
+{
+  attempt(clock_gettime(CLOCK_MONOTONIC, result), "clock_gettime()");
+}
+
+/**
+ * @brief Get the current realtime clock time from the computer.
  */
 void get_current_realtime_time(struct timespec *result)
 {
@@ -28,6 +37,14 @@ double get_time_in_seconds(struct timespec *time)
   return ((double)(time->tv_sec)) + (((double)(time->tv_nsec)) / NANOSECONDS_PER_SECOND);
 }
 
+/**
+ * @brief Convert a `timespec` into nanoseconds.
+ */
+long long get_time_in_nanoseconds(struct timespec *time)
+{
+  return (long long)time->tv_sec * NANOSECONDS_PER_SECOND + time->tv_nsec;
+}
+
 /**
  * @brief Normalize a `timespec` by correcting any overflow or underflow in the
  * nanoseconds.
@@ -35,7 +52,7 @@ double get_time_in_seconds(struct timespec *time)
 void normalize_timespec(struct timespec *time)
 {
   // Account for overflow.
-  while (time->tv_nsec > NANOSECONDS_PER_SECOND)
+  while (time->tv_nsec >= NANOSECONDS_PER_SECOND)
   {
     time->tv_sec += 1;
     time->tv_nsec -= NANOSECONDS_PER_SECOND;
@@ -69,6 +86,15 @@ double get_elapsed_time_in_seconds(struct timespec *start_time, struct timespec
   return get_time_in_seconds(&elapsed_time);
 }
 
+/**
+ * @brief Calculate the difference between two `timespec`s and return the
+ * result in nanoseconds.
+ */
+long long get_elapsed_time_in_nanoseconds(struct timespec *start_time, struct timespec *end_time)
+{
+  return get_time_in_nanoseconds(end_time) - get_time_in_nanoseconds(start_time);
+}
+
 /**
  * @brief Print the difference between two `timespecs`.
  */
@@ -83,5 +109,15 @@ void print_elapsed_time(struct timespec *start_time, struct timespec *end_time,
 void get_timespec_from_seconds(double seconds, struct timespec *result)
 {
   result->tv_sec = floor(seconds);
-  result->tv_nsec = remainder(seconds, 1) * NANOSECONDS_PER_SECOND;
+  result->tv_nsec = fmod(seconds, 1) * NANOSECONDS_PER_SECOND;
+}
+
+/**
+ * @brief Add a number of nanoseconds to a `timespec`, in place.
+ */
+void add_nanoseconds_to_timespec(struct timespec *time, long long nanoseconds)
+{
+  time->tv_sec += nanoseconds / NANOSECONDS_PER_SECOND;
+  time->tv_nsec += nanoseconds % NANOSECONDS_PER_SECOND;
+  normalize_timespec(time);
 }
@@ -8,12 +8,16 @@
 #define MICROSECONDS_PER_SECOND (1000000)
 
 void get_current_monotonic_raw_time(struct timespec *result);
+void get_current_monotonic_time(struct timespec *result);
 void get_current_realtime_time(struct timespec *result);
 double get_time_in_seconds(struct timespec *time);
+long long get_time_in_nanoseconds(struct timespec *time);
 void normalize_timespec(struct timespec *time);
 void get_elapsed_time(struct timespec *start_time, struct timespec *end_time, struct timespec *result);
 double get_elapsed_time_in_seconds(struct timespec *start_time, struct timespec *end_time);
+long long get_elapsed_time_in_nanoseconds(struct timespec *start_time, struct timespec *end_time);
 void print_elapsed_time(struct timespec *start_time, struct timespec *end_time, const char *prefix_text);
 void get_timespec_from_seconds(double seconds, struct timespec *result);
+void add_nanoseconds_to_timespec(struct timespec *time, long long nanoseconds);
 
 #endif
@@ -0,0 +1,181 @@
+/**
+ * @author Nick McCrea (nickmccrea.com)
+ * @brief Final project for Real Time Embedded Systems series, University of
+ * Colorado Boulder's online MSEE. Instructor Dr. Sam Siewert.
+ * @date 2022
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include "sequencer.hpp"
+#include "utils/error.h"
+#include "utils/log.h"
+#include "worker_pool.hpp"
+
+/**
+ * @brief Take items from the pool's current job until none are left.
+ */
+void run_job_items(WorkerPool *worker_pool)
+{
+  int item;
+  while ((item = __atomic_fetch_add(&worker_pool->next_job_item, 1, __ATOMIC_RELAXED)) < worker_pool->job_item_count)
+    (worker_pool->job_function)(worker_pool->job_context, item);
+}
+
+/**
+ * @brief Wait on a semaphore, retrying if interrupted.
+ */
+void wait_for_semaphore(sem_t *semaphore)
+{
+  int result;
+  while ((result = sem_wait(semaphore)) == -1 && errno == EINTR)
+    ;
+  attempt(result, "sem_wait()");
+}
+
+/**
+ * @brief A worker thread, which helps with each job it is started on.
+ */
+void *WorkerThread(void *worker_pointer)
+{
+  Worker *worker = (Worker *)worker_pointer;
+  WorkerPool *worker_pool = worker->worker_pool;
+
+  while (TRUE)
+  {
+    wait_for_semaphore(&worker->start_semaphore);
+    if (worker_pool->exit_flag)
+      break;
+    run_job_items(worker_pool);
+    attempt(sem_post(&worker_pool->done_semaphore), "sem_post()");
+  }
+
+  return (void *)0;
+}
+
+/**
+ * @brief Start a pool of worker threads, each pinned to the given CPU.
+ *
+ * The workers inherit the calling thread's scheduling policy and priority, so
+ * a pool started by a service runs at that service's priority, never above it.
+ */
+void initialize_worker_pool(WorkerPool *worker_pool, int worker_count, const int *worker_cpus)
+{
+  if (worker_count > MAXIMUM_POOL_WORKERS)
+    print_error_and_exit("Worker pool: %i workers exceeds the maximum of %i\n", worker_count, MAXIMUM_POOL_WORKERS);
+
+  worker_pool->worker_count = worker_count;
+  worker_pool->exit_flag = FALSE;
+  attempt(sem_init(&worker_pool->done_semaphore, 0, 0), "sem_init()");
+
+  for (int index = 0; index < worker_count; ++index)
+  {
+    Worker *worker = &worker_pool->workers[index];
+    worker->worker_pool = worker_pool;
+    worker->cpu = worker_cpus[index];
+    attempt(sem_init(&worker->start_semaphore, 0, 0), "sem_init()");
+
+    pthread_attr_t thread_attributes;
+    errno = pthread_attr_init(&thread_attributes);
+    if (errno)
+      print_with_errno_and_exit("pthread_attr_init()");
+    errno = pthread_attr_setinheritsched(&thread_attributes, PTHREAD_INHERIT_SCHED);
+    if (errno)
+      print_with_errno_and_exit("pthread_attr_setinheritsched()");
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(worker->cpu, &cpu_set);
+    errno = pthread_attr_setaffinity_np(&thread_attributes, sizeof(cpu_set_t), &cpu_set);
+    if (errno)
+      print_with_errno_and_exit("pthread_attr_setaffinity_np()");
+
+    errno = pthread_create(&worker->thread, &thread_attributes, WorkerThread, (void *)worker);
+    if (errno)
+      print_with_errno_and_exit("pthread_create()");
+    pthread_attr_destroy(&thread_attributes);
+
+    write_log("Worker Pool: Worker %i, CPU: %i", index, worker->cpu);
+  }
+}
+
+/**
+ * @brief Stop and join the pool's worker threads.
+ */
+void uninitialize_worker_pool(WorkerPool *worker_pool)
+{
+  worker_pool->exit_flag = TRUE;
+  for (int index = 0; index < worker_pool->worker_count; ++index)
+    attempt(sem_post(&worker_pool->workers[index].start_semaphore), "sem_post()");
+  for (int index = 0; index < worker_pool->worker_count; ++index)
+  {
+    errno = pthread_join(worker_pool->workers[index].thread, NULL);
+    if (errno)
+      print_with_errno_and_exit("pthread_join()");
+    sem_destroy(&worker_pool->workers[index].start_semaphore);
+  }
+  sem_destroy(&worker_pool->done_semaphore);
+  worker_pool->worker_count = 0;
+}
+
+/**
+ * @brief Run a job of the given number of items across the pool and the
+ * calling thread, returning once every item is done.
+ *
+ * Items are handed out one at a time to whichever thread is free, so a worker
+ * that is slow to start simply takes fewer of them.
+ */
+void run_worker_pool_job(WorkerPool *worker_pool, void (*job_function)(void *job_context, int item), void *job_context, int job_item_count)
+{
+  worker_pool->job_function = job_function;
+  worker_pool->job_context = job_context;
+  worker_pool->job_item_count = job_item_count;
+  worker_pool->next_job_item = 0;
+
+  // Fork.
+  for (int index = 0; index < worker_pool->worker_count; ++index)
+    attempt(sem_post(&worker_pool->workers[index].start_semaphore), "sem_post()");
+  run_job_items(worker_pool);
+
+  // Join.
+  for (int index = 0; index < worker_pool->worker_count; ++index)
+    wait_for_semaphore(&worker_pool->done_semaphore);
+}
+
+/**
+ * @brief Start a thread under `SCHED_OTHER`, pinned to the given CPU, for
+ * slow work that must not compete with the real-time services.
+ */
+void start_background_thread(pthread_t *thread, int cpu, void *(*thread_function)(void *), void *thread_parameters)
+{
+  pthread_attr_t thread_attributes;
+  errno = pthread_attr_init(&thread_attributes);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_init()");
+
+  errno = pthread_attr_setinheritsched(&thread_attributes, PTHREAD_EXPLICIT_SCHED);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setinheritsched()");
+
+  errno = pthread_attr_setschedpolicy(&thread_attributes, SCHED_OTHER);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setschedpolicy()");
+
+  struct sched_param schedule_parameters = {.sched_priority = 0};
+  errno = pthread_attr_setschedparam(&thread_attributes, &schedule_parameters);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setschedparam()");
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  errno = pthread_attr_setaffinity_np(&thread_attributes, sizeof(cpu_set_t), &cpu_set);
+  if (errno)
+    print_with_errno_and_exit("pthread_attr_setaffinity_np()");
+
+  errno = pthread_create(thread, &thread_attributes, thread_function, thread_parameters);
+  if (errno)
+    print_with_errno_and_exit("pthread_create()");
+  pthread_attr_destroy(&thread_attributes);
+}
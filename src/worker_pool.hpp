@@ -0,0 +1,43 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#define MAXIMUM_POOL_WORKERS (8)
+
+/**
+ * @brief A worker thread in a worker pool, pinned to a CPU.
+ */
+typedef struct Worker
+{
+  struct WorkerPool *worker_pool;
+  int cpu;
+  pthread_t thread;
+  sem_t start_semaphore;
+} Worker;
+
+/**
+ * @brief A fork-join pool of worker threads, each pinned to its own CPU.
+ *
+ * The thread running a job takes part in it, so a pool without workers simply
+ * runs the job on the calling thread.
+ */
+typedef struct WorkerPool
+{
+  int worker_count;
+  Worker workers[MAXIMUM_POOL_WORKERS];
+  sem_t done_semaphore;
+  int exit_flag;
+  void (*job_function)(void *job_context, int item);
+  void *job_context;
+  int job_item_count;
+  int next_job_item;
+} WorkerPool;
+
+void initialize_worker_pool(WorkerPool *worker_pool, int worker_count, const int *worker_cpus);
+void uninitialize_worker_pool(WorkerPool *worker_pool);
+void run_worker_pool_job(WorkerPool *worker_pool, void (*job_function)(void *job_context, int item), void *job_context, int job_item_count);
+void start_background_thread(pthread_t *thread, int cpu, void *(*thread_function)(void *), void *thread_parameters);
+
+#endif